@@ -1,478 +1,4392 @@
-/* ***** THIS FILE SHOULD NOT BE MODIFIED ****************************
-   THERE IS NOT REASON THAT ANY STUDENT SHOULD HAVE TO READ OR UNDERSTAND
-   THE CODE BELOW.  YOU SHOLD NOT TOUCH, OR REFERENCE (in your code) ANY
-   OF THE DATA STRUCTURES BELOW.  If you're interested in how I designed
-   the emulator, you're welcome to look at the code - but again, you should have
-   to, and you defeinitely should not have to modify
-   This file contains the code that emulates the network.  It does not
-   implement any of the Go-Back-N protocol.
-   ********************************************************************
-
-   ******************************************************************
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
-   The code below emulates the layer 3 and below network environment:
-   - emulates the tranmission and delivery (possibly with bit-level corruption
-   and packet loss) of packets across the layer 3/4 interface
-   - handles the starting/stopping of a timer, and generates timer
-   interrupts (resulting in calling students timer handler).
-   - generates message to be sent (passed from later 5 to 4)
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications (6/6/2008 - CLP): 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - removed hard coded maximum random number, use library defined
-   RAND_MAX value 
-   - simulator stops when no events are left rather than stopping as
-   soon as n packets are sent.
-   - fixed C style to adhere to current programming style
-
-   ********************************************************************* */
-#include <stdlib.h>
-#include <stdio.h>
-#include "emulator.h"
-#include "gbn.h"
-
-struct event {
-  float evtime;           /* event time */
-  int evtype;             /* event type code */
-  int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
-};
-
-struct event *evlist = NULL;   /* the event list */
-
-/* possible events: */
-#define  TIMER_INTERRUPT 0  
-#define  FROM_LAYER5     1
-#define  FROM_LAYER3     2
-
-#define  OFF             0
-#define  ON              1
-
-int TRACE = 3;
-
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
-
-/****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
-/****************************************************************************/
-double jimsrand(void) 
-{
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
-  return(x);
-}  
-
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
-/*****************************************************/
-
-void insertevent(struct event *p)
-{
-  struct event *q,*qold;
-
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
-  }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
-  }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
-    }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
-    }
-  }
-}
-
-void generate_next_arrival(void)
-{
-  double x;
-  struct event *evptr;
-
-  if (TRACE>2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
- 
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
-  evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
-    evptr->eventity = B;
-  else
-    evptr->eventity = A;
-  insertevent(evptr);
-} 
-
-void printevlist(void)
-{
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
-  }
-  printf("--------------\n");
-}
-
-void init(void)                         /* initialize the simulator */
-{
-  float sum, avg;
-  int i;
-
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
-
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
-}
-
-/********************** Student-callable ROUTINES ***********************/
-
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
-{
-  struct event *q;
-
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
-}
-
-
-void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
-{
-
-  struct event *q;
-  struct event *evptr;
-
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
- 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
-  evptr->evtype =  TIMER_INTERRUPT;
-   
- 
-  evptr->eventity = AorB;
-  insertevent(evptr);
-} 
-
-
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
-{
-  struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
-
-  ntolayer3++;
-
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being lost\n");
-    return;
-  }  
-
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
-  }
-
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
-
-
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being corrupted\n");
-  }  
-
-  if (TRACE>2)  
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
-} 
-
-void tolayer5(int AorB, char datasent[20])
-{
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
-  }
-  messages_delivered++;
-}
-
-int main(void)
-{
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
-      }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
-    }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
-    }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
-    }
-    free(eventptr);
-  }
-
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
+/* ***** THIS FILE SHOULD NOT BE MODIFIED ****************************
+   THERE IS NOT REASON THAT ANY STUDENT SHOULD HAVE TO READ OR UNDERSTAND
+   THE CODE BELOW.  YOU SHOLD NOT TOUCH, OR REFERENCE (in your code) ANY
+   OF THE DATA STRUCTURES BELOW.  If you're interested in how I designed
+   the emulator, you're welcome to look at the code - but again, you should have
+   to, and you defeinitely should not have to modify
+   This file contains the code that emulates the network.  It does not
+   implement any of the Go-Back-N protocol.
+   ********************************************************************
+
+   ******************************************************************
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
+   The code below emulates the layer 3 and below network environment:
+   - emulates the tranmission and delivery (possibly with bit-level corruption
+   and packet loss) of packets across the layer 3/4 interface
+   - handles the starting/stopping of a timer, and generates timer
+   interrupts (resulting in calling students timer handler).
+   - generates message to be sent (passed from later 5 to 4)
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+   - with linkrate= set, each direction is instead a link of fixed
+   bandwidth and propagation delay behind a finite drop-tail queue
+   - with topology= set, packets instead cross store-and-forward routers
+   over links that each have their own capacity, delay, queue and loss
+
+   Modifications (6/6/2008 - CLP): 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - removed hard coded maximum random number, use library defined
+   RAND_MAX value 
+   - simulator stops when no events are left rather than stopping as
+   soon as n packets are sent.
+   - fixed C style to adhere to current programming style
+
+   ********************************************************************* */
+#define _POSIX_C_SOURCE 200112L   /* for mmap, clock_gettime and barriers with -ansi */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#define time libc_time            /* the emulator's clock is called time */
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#undef time
+#include "emulator.h"
+#include "sr.h"
+
+struct event {
+  double evtime;          /* event time */
+  int evtype;             /* event type code */
+  int eventity;           /* entity where event occurs */
+  int evflow;             /* flow of a FROM_LAYER5 event */
+  int evnode;             /* router a ROUTER event has reached, link owner of a LINK_DONE */
+  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  long evseq;             /* order of insertion, to order events at the same time */
+  int evsource;           /* process that made it, under threads= */
+  int heappos;            /* index in the event heap */
+};
+
+/* the event list is a binary heap ordered by time; events at the same  */
+/* time come out newest first, as from the original sorted list.  Under */
+/* threads= they come out oldest first by the count of the process that */
+/* made them, which every process keeps ahead of the events it runs, so */
+/* the order is the same however the threads are scheduled.  So is it   */
+/* under parallelorder=1, which runs them in one list; see lporderinit() */
+static LPLOCAL struct event **evheap;
+static LPLOCAL int nevents;
+static LPLOCAL int evcap;
+static LPLOCAL long evinserted;   /* events inserted so far */
+static LPLOCAL struct event *timerevents[2];  /* pending TIMER_INTERRUPT of A and B */
+static LPLOCAL long evprocessed;  /* events taken off the list by the main loop */
+static LPLOCAL int evhighwater;   /* largest number of events pending at once */
+
+/* under the parallel engine (threads=) each thread runs one logical */
+/* process, with an event list of its own; see runparallel()         */
+static int nthreads;              /* threads=, 0 for the sequential engine */
+static int lporder;               /* parallelorder=, the sequential engine run as the processes */
+static LPLOCAL int lpid = -1;     /* node of the thread's process, -1 under the sequential engine */
+static int lpnode(struct event *);
+static void lpsend(struct event *);
+
+/* possible events: */
+#define  TIMER_INTERRUPT 0  
+#define  FROM_LAYER5     1
+#define  FROM_LAYER3     2
+#define  LINK_DONE       3  /* a link has finished sending a packet */
+#define  SCENARIO        4  /* changes from the scenario file are due */
+#define  ROUTER          5  /* a packet has reached a router of the topology */
+
+#define  OFF             0
+#define  ON              1
+
+int TRACE = 3;
+
+/* statistics updated by GBN */
+LPLOCAL int window_full;   /* count of the number of messages dropped due to full window */
+LPLOCAL int total_ACKs_received;
+LPLOCAL int packets_resent;       /* count of the number of packets resent  */
+LPLOCAL int new_ACKs;           /* count of the number of acks correctly received */
+LPLOCAL int packets_received;  /* count of the packets received by receiver */
+LPLOCAL int backlog_queued;    /* messages that waited in A's backlog for the window */
+LPLOCAL int backlog_highwater; /* largest number of messages in the backlog at once */
+LPLOCAL double backlog_delay;  /* total time messages spent in the backlog */
+LPLOCAL double backlog_maxdelay; /* longest time a message spent in the backlog */
+LPLOCAL int coalesced_msgs;    /* messages packed into a coalesced batch at A */
+LPLOCAL int coalesce_saved;    /* packets saved by coalescing */
+LPLOCAL double coalesce_delay; /* total time messages waited for their batch to be sent */
+LPLOCAL int acks_sent;         /* ACK packets sent by B */
+LPLOCAL int acks_coalesced;    /* ACK packets saved by combining delayed ACKs */
+LPLOCAL int acks_piggybacked;  /* delayed ACKs carried on a data packet instead */
+LPLOCAL long ackbytes_sent;    /* bytes of standalone ACK packets */
+LPLOCAL long ackbytes_saved;   /* bytes of the ACK packets piggybacking made unnecessary */
+LPLOCAL int spurious_resends;  /* packets B received again after already having them */
+LPLOCAL int naks_sent;         /* NAK packets sent by B */
+LPLOCAL int nak_resends;       /* packets A resent in answer to a NAK */
+LPLOCAL int recovered_nak;     /* lost packets whose first resend was NAK-triggered */
+LPLOCAL int recovered_timeout; /* lost packets whose first resend was a timeout */
+LPLOCAL double recovery_nak_time;      /* total first-send-to-ACK time of those */
+LPLOCAL double recovery_timeout_time;
+LPLOCAL int timeouts;          /* retransmission timeouts at A */
+LPLOCAL int rtt_samples;       /* round trip times measured on packets never resent */
+LPLOCAL double rtt_sample_total;
+LPLOCAL double rto_last;       /* retransmission timeout in force at the end */
+LPLOCAL int cwnd_cuts;         /* congestion window reductions at A */
+LPLOCAL double cwnd_area;      /* integral of cwnd over time up to cwnd_changed */
+LPLOCAL double cwnd_changed;   /* time cwnd last changed */
+LPLOCAL double cwnd_last;      /* congestion window at the end */
+LPLOCAL int paced_packets;     /* packets A sent through the pacer */
+LPLOCAL double pace_delay;     /* total time they waited for a token */
+LPLOCAL int recv_held[RECVHIST]; /* packets B holds out of order, counted after each arrival */
+LPLOCAL int msg_latency[LATBUCKETS]; /* messages by time from A_output() to delivery to layer 5 */
+LPLOCAL double msg_latency_total;
+LPLOCAL double msg_latency_max;
+LPLOCAL int hol_wait[LATBUCKETS];    /* packets by time held out of order, waiting for the gap */
+LPLOCAL double hol_wait_total;
+LPLOCAL double hol_wait_max;
+
+/* statistics updated by emulator */
+static LPLOCAL int packets_lost;  
+static LPLOCAL int packets_corrupt;
+static LPLOCAL int packets_sent;
+static LPLOCAL int packets_timeout;
+static LPLOCAL int messages_delivered;
+
+static LPLOCAL int nsim = 0;              /* number of messages from 5 to 4 so far */ 
+static int nsimmax = 0;           /* number of msgs to generate, then stop */
+static LPLOCAL double time = 0.000;
+static float lossprob;            /* probability that a packet is dropped  */
+static float corruptprob;   /* probability that one bit is packet is flipped */
+static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
+static float lambda;        /* arrival rate of messages from layer 5 */   
+static int bidirectional;   /* layer 5 at B sends messages too (bidirectional= option) */
+static LPLOCAL int ntolayer3;      /* number sent into layer 3 */
+static LPLOCAL int nlost;          /* number lost in media */
+static LPLOCAL int ncorrupt;       /* number corrupted by media*/
+static LPLOCAL long bytestolayer3;        /* header and payload bytes sent into layer 3 */
+static LPLOCAL long payloadtolayer3;      /* payload bytes sent into layer 3 */
+static LPLOCAL long byteslost;            /* header and payload bytes lost in media */
+static LPLOCAL long bytesdelivered;       /* payload bytes delivered to layer 5 */
+
+/* packets A gives layer 3 at the same instant form one burst; bursts are */
+/* counted by size in the bins 1, 2, 3-4, 5-8, ..., 65 and over           */
+#define NBURSTBINS 8
+static LPLOCAL int bursts[NBURSTBINS];
+static LPLOCAL int burstlen;              /* packets in the current burst */
+static LPLOCAL double burstat;          /* time of the current burst */
+static LPLOCAL int maxburst;
+
+/* with linkrate= set, each direction is a link of that many bits per time */
+/* unit with propagation delay linkdelay, fed by a queue holding linkqueue  */
+/* packets (bytes with queueunit=bytes; 0 for no limit).  aqm= picks how   */
+/* the queue is managed: droptail drops only when it is full, red also     */
+/* drops at enqueue with a probability that grows with the average queue,  */
+/* and codel drops at dequeue once packets have waited longer than         */
+/* codeltarget for a whole codelinterval.  sched= picks the order the     */
+/* queue is served in: fifo, or drr (deficit round robin), which keeps a    */
+/* queue per flow and lets each backlogged flow send up to its quantum of   */
+/* bytes per round.  quantum= sets every flow's quantum (default one full   */
+/* packet) and quanta=q0,q1,... sets flows 0, 1, ... individually.  Options */
+/* ending in _ab or _ba set one direction only.  Without linkrate the       */
+/* original channel is used: arrival 1 to 10 time units after the last      */
+/* packet already in flight.                                                */
+#define AQM_DROPTAIL 0
+#define AQM_RED 1
+#define AQM_CODEL 2
+
+#define QUEUE_FIFO 0
+#define QUEUE_DRR 1
+
+struct linkentry {
+  struct event *ev;       /* arrival at the other side, NULL if lost in the medium */
+  int size;               /* header and payload bytes */
+  double enqueued;
+};
+
+/* a growable ring of packets, oldest first */
+struct pktring {
+  struct linkentry *entries;
+  int head, count, cap;
+};
+
+/* a flow's queue at a DRR link */
+struct flowqueue {
+  struct pktring ring;
+  int deficit;            /* bytes the flow may still send this round */
+  int fresh;              /* the quantum is still to be added on its next turn */
+};
+
+struct link {
+  int node;               /* node that sends on the link */
+  double rate;            /* bits per time unit, 0 for the original channel */
+  double delay;           /* propagation delay */
+  int limit;              /* queue capacity, 0 for no limit */
+  int bytes;              /* limit and RED thresholds count bytes rather than packets */
+  int aqm;
+  int sched;
+  struct pktring fifo;    /* packets waiting for the link under sched=fifo */
+  struct flowqueue *flows;  /* nflows queues under sched=drr */
+  int *active;            /* ring of flows with packets waiting, in the order they are served */
+  int firstactive, nactive, maxactive;
+  int count;              /* packets waiting */
+  int qbytes;             /* bytes waiting */
+  int sending;            /* bytes of the packet being transmitted, 0 when idle */
+  double changed;         /* time the occupancy integrals were brought up to */
+  double minth, maxth;    /* RED thresholds on the average queue */
+  double maxp, weight;
+  double avg;             /* RED average queue */
+  int redcount;           /* packets enqueued since the last RED drop */
+  double idlesince;       /* when the link last went idle, -1 while busy */
+  double target, interval;  /* CoDel parameters */
+  double first_above;     /* when CoDel may start dropping, 0 while below target */
+  double drop_next;       /* next CoDel drop while in the dropping state */
+  int dropcount, lastcount;
+  int dropping;
+  int sent;               /* packets transmitted */
+  int drops;              /* packets dropped because the queue was full */
+  int aqmdrops;           /* packets dropped early by RED or CoDel */
+  int maxpackets, maxbytes;
+  double area, areabytes; /* occupancy integrated over time */
+  double busy;            /* total transmission time */
+  double sojourn;         /* total time transmitted packets waited in the queue */
+  double maxsojourn;
+};
+static struct link *links;      /* links[A] carries A to B, links[B] B to A, then the hops of topology= */
+
+int mtu = 20;                     /* largest payload layer 3 carries, in bytes */
+int msgsize = 20;                 /* bytes in each message from layer 5 */
+int nflows = 1;                   /* connections multiplexed between A and B */
+int headersize = HEADERSIZE;      /* header bytes of each packet */
+LPLOCAL struct flowstats *flowstats;  /* nflows of them */
+static int *quanta;               /* bytes each flow may send per DRR round */
+static LPLOCAL char *msgdata;     /* contents of the message given to layer 4 */
+
+static int noptions;              /* name=value options from the command line */
+static char **options;
+
+/* payload buffers for packets in the medium are recycled through a free */
+/* list rather than going back to malloc for every packet.  Each logical */
+/* process of threads= keeps a list of its own; see lpadopt()            */
+static LPLOCAL char *freebufs = NULL;
+static LPLOCAL int nbufs;                 /* number of pool buffers ever allocated */
+
+/* the random number generator: the additive feedback generator of the C */
+/* library's rand() (glibc's TYPE_3), so seeded like srand() it gives the  */
+/* same numbers, but with its state here, where the parallel engine can    */
+/* give every logical process streams of its own                          */
+struct rng {
+  unsigned int r[34];     /* the last 34 numbers */
+  int i;                  /* where the next one goes */
+};
+
+static LPLOCAL struct rng rngs[2];  /* the model's stream, and the arrivals' under threads= */
+static LPLOCAL int rngstream;       /* the stream jimsrand() draws from */
+
+/* the next number, in [0, 2^31 - 1] */
+static int rngnext(struct rng *g)
+{
+  unsigned int x = g->r[(g->i + 3) % 34] + g->r[(g->i + 31) % 34];
+
+  g->r[g->i] = x;
+  g->i = (g->i + 1) % 34;
+  return (int)(x >> 1);
+}
+
+static void rngseed(struct rng *g, unsigned int seed)
+{
+  long hi, lo, word;
+  int i;
+
+  g->r[0] = seed != 0 ? seed : 1;
+  for (i = 1; i < 31; i++) {   /* 16807 * r mod 2^31 - 1, without overflow */
+    hi = (long)(int)g->r[i - 1] / 127773;
+    lo = (long)(int)g->r[i - 1] % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0)
+      word += 2147483647;
+    g->r[i] = (unsigned int)word;
+  }
+  for (i = 31; i < 34; i++)
+    g->r[i] = g->r[i - 31];
+  g->i = 0;
+  for (i = 0; i < 310; i++)    /* discarded, as srand() does */
+    rngnext(g);
+}
+
+/* record and replay.  record= writes every random number drawn and every */
+/* event run to a log: a byte saying what it is, then the number, or the  */
+/* event's time, type and entity.  The numbers are marked as drawn for    */
+/* the arrivals of layer 5 or for the channel.  replay= draws the numbers  */
+/* from such a log instead, each kind in the order it was recorded, so    */
+/* that a run with other code or settings meets the same arrivals and     */
+/* the same channel, and checks each event run against the log.  The      */
+/* first one that differs is reported.  tracefrom= holds the trace back   */
+/* until that time and until= ends the run, so a window of a run can be   */
+/* traced alone; resume= from a checkpoint taken at its start skips the   */
+/* run up to it, and replays a log recorded when resuming from the same   */
+/* snapshot                                                                */
+#define LOGMAGIC "srlog1"
+#define LOG_ARRIVAL 'a'           /* a number drawn for an arrival */
+#define LOG_CHANNEL 'c'           /* a number drawn for the channel */
+#define LOG_EVENT 'e'             /* an event run */
+
+struct logevent {
+  double time;
+  signed char type, entity;
+};
+
+static LPLOCAL int drawing = LOG_CHANNEL;  /* what jimsrand() draws for */
+static FILE *recordf;             /* record= */
+static const char *recordname;
+static long recorded[3];          /* numbers for arrivals and the channel, and events */
+static const char *replayname;    /* replay= */
+static const unsigned char *replaylog;
+static long replaylen;
+static long replaypos[3];         /* where the next of each kind is looked for */
+static long replayed[3];          /* taken from the log */
+static long replayshort[3];       /* wanted after the log had no more */
+static long diverged = -1;        /* the first event run that differs from the log */
+static struct logevent divergedlog, divergedrun;
+static int tracelevel;            /* the TRACE asked for, held back until tracefrom= */
+static double tracefrom = -1;
+static double until = -1;         /* until=, -1 to run to the end */
+
+static int logkind(int tag)
+{
+  return tag == LOG_ARRIVAL ? 0 : tag == LOG_CHANNEL ? 1 : 2;
+}
+
+static size_t logsize(int tag)
+{
+  return tag == LOG_EVENT ? sizeof(double) + 2 : sizeof(int);
+}
+
+static void logwrite(int tag, const void *p, size_t n)
+{
+  putc(tag, recordf);
+  if (fwrite(p, 1, n, recordf) != n) {
+    printf("cannot write log %s.", recordname);
+    exit(EXIT_FAILURE);
+  }
+  recorded[logkind(tag)]++;
+}
+
+/* the next entry of the kind in the replayed log, 0 if there are no more */
+static int logread(int tag, void *p)
+{
+  long *pos = &replaypos[logkind(tag)];
+
+  while (*pos < replaylen && *pos + 1 + (long)logsize(replaylog[*pos]) <= replaylen) {
+    if (replaylog[*pos] == tag) {
+      memcpy(p, replaylog + *pos + 1, logsize(tag));
+      *pos += 1 + logsize(tag);
+      replayed[logkind(tag)]++;
+      return 1;
+    }
+    *pos += 1 + logsize(replaylog[*pos]);
+  }
+  replayshort[logkind(tag)]++;
+  return 0;
+}
+
+/* the number drawn, or the one the log has in its place */
+static int lognumber(int n)
+{
+  int logged;
+
+  if (recordf != NULL)
+    logwrite(drawing, &n, sizeof(n));
+  if (replaylog != NULL && logread(drawing, &logged))
+    return logged;
+  return n;
+}
+
+/* record the event about to run, or check it against the log */
+static void logevent(struct event *ev)
+{
+  unsigned char buf[sizeof(double) + 2];
+  struct logevent run, logged;
+
+  run.time = ev->evtime;
+  run.type = (signed char)ev->evtype;
+  run.entity = (signed char)ev->eventity;
+  if (recordf != NULL) {
+    memcpy(buf, &run.time, sizeof(double));
+    buf[sizeof(double)] = (unsigned char)run.type;
+    buf[sizeof(double) + 1] = (unsigned char)run.entity;
+    logwrite(LOG_EVENT, buf, sizeof(buf));
+  }
+  if (replaylog == NULL || !logread(LOG_EVENT, buf))
+    return;
+  memcpy(&logged.time, buf, sizeof(double));
+  logged.type = (signed char)buf[sizeof(double)];
+  logged.entity = (signed char)buf[sizeof(double) + 1];
+  if (diverged < 0 && (logged.time != run.time || logged.type != run.type ||
+                       logged.entity != run.entity)) {
+    diverged = replayed[2];
+    divergedlog = logged;
+    divergedrun = run;
+    if (TRACE>0)
+      printf("          REPLAY: this event differs from the log\n");
+  }
+}
+
+static void replayinit(void)
+{
+  struct stat st;
+  int fd;
+
+  recordname = getoptionstr("record", NULL);
+  replayname = getoptionstr("replay", NULL);
+  tracefrom = getoption("tracefrom", -1);
+  until = getoption("until", -1);
+  if (recordname == NULL && replayname == NULL && tracefrom < 0 && until < 0)
+    return;
+  if (nthreads > 0) {
+    printf("record, replay, tracefrom and until apply to the sequential engine, not to threads\n");
+    exit(EXIT_FAILURE);
+  }
+  if (tracefrom > 0) {
+    tracelevel = TRACE;
+    TRACE = 0;
+  } else
+    tracefrom = -1;
+  if (recordname != NULL) {
+    recordf = fopen(recordname, "wb");
+    if (recordf == NULL || fwrite(LOGMAGIC, sizeof(LOGMAGIC), 1, recordf) != 1) {
+      printf("cannot write log %s.", recordname);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (replayname != NULL) {
+    fd = open(replayname, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(LOGMAGIC)) {
+      printf("cannot read log %s.", replayname);
+      exit(EXIT_FAILURE);
+    }
+    replaylog = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (replaylog == MAP_FAILED || memcmp(replaylog, LOGMAGIC, sizeof(LOGMAGIC)) != 0) {
+      printf("%s is not a log.", replayname);
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+    replaylen = st.st_size;
+    replaypos[0] = replaypos[1] = replaypos[2] = sizeof(LOGMAGIC);
+  }
+}
+
+static void replayreport(void)
+{
+  long bytes;
+
+  if (recordf != NULL) {
+    bytes = ftell(recordf);
+    if (fclose(recordf) != 0) {
+      printf("cannot write log %s.", recordname);
+      exit(EXIT_FAILURE);
+    }
+    printf("record: %ld random numbers for arrivals, %ld for the channel and %ld events written to %s (%ld bytes)\n",
+           recorded[0], recorded[1], recorded[2], recordname, bytes);
+  }
+  if (replaylog == NULL)
+    return;
+  printf("replay: %ld random numbers for arrivals and %ld for the channel taken from %s",
+         replayed[0], replayed[1], replayname);
+  if (replayshort[0] + replayshort[1] > 0)
+    printf(", %ld drawn after it ran out", replayshort[0] + replayshort[1]);
+  printf("\n");
+  if (diverged < 0)
+    printf("replay: the %ld events run matched the log%s\n", replayed[2],
+           replayshort[2] > 0 ? ", which ended before the run" : "");
+  else
+    printf("replay: event %ld differs from the log: type %d at entity %d at time %f, "
+           "where the log has type %d at entity %d at time %f\n",
+           diverged, divergedrun.type, divergedrun.entity, divergedrun.time,
+           divergedlog.type, divergedlog.entity, divergedlog.time);
+}
+
+/****************************************************************************/
+/* jimsrand(): return a double in range [0,1].  The routine below is used to */
+/* isolate all random number generation in one location.                    */
+/****************************************************************************/
+double jimsrand(void) 
+{
+  double mmm = 2147483647;   /* largest number rngnext() returns */
+  double x;                   
+  x = lognumber(rngnext(&rngs[rngstream]))/mmm;  /* x should be uniform in [0,1] */
+  if (TRACE > 3)
+    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  return(x);
+}  
+
+/****************************************************************************/
+/* getoption(): return the value of a name=value option from the command   */
+/* line, or defval if the option was not given                              */
+/****************************************************************************/
+const char *getoptionstr(const char *name, const char *defval)
+{
+  int i;
+  size_t len = strlen(name);
+
+  for (i=0; i<noptions; i++)
+    if (strncmp(options[i], name, len) == 0 && options[i][len] == '=')
+      return options[i] + len + 1;
+  return defval;
+}
+
+double getoption(const char *name, double defval)
+{
+  const char *value = getoptionstr(name, NULL);
+
+  return value != NULL ? atof(value) : defval;
+}
+
+double simtime(void)
+{
+  return time;
+}
+
+/********************* LATENCY HISTOGRAMS ***********/
+/* HDR-style: a time t in [2^e, 2^(e+1)) falls in one of LATSUB equal   */
+/* buckets of that doubling.  Times below 2^LATMINEXP share the first  */
+/* bucket and those past the last doubling the last                     */
+
+void latency_add(int *hist, double t)
+{
+  int e, i;
+  double m;
+
+  if (t < ldexp(1.0, LATMINEXP)) {
+    hist[0]++;
+    return;
+  }
+  m = frexp(t, &e);    /* t = m * 2^e, m in [0.5, 1) */
+  i = (e - 1 - LATMINEXP) * LATSUB + (int)((2 * m - 1) * LATSUB);
+  hist[i < LATBUCKETS ? i : LATBUCKETS - 1]++;
+}
+
+/* the time within which fraction p of those counted fell: the top of */
+/* its bucket, or max if that is lower                                 */
+static double percentile(int *hist, double p, double max)
+{
+  long n = 0, seen = 0;
+  double top;
+  int i;
+
+  for (i = 0; i < LATBUCKETS; i++)
+    n += hist[i];
+  for (i = 0; i < LATBUCKETS - 1; i++) {
+    seen += hist[i];
+    if (seen >= p * n)
+      break;
+  }
+  top = ldexp(1.0 + (double)(i % LATSUB + 1) / LATSUB, i / LATSUB + LATMINEXP);
+  return top < max ? top : max;
+}
+
+static void latencyline(const char *what, int *hist, double total, double max)
+{
+  long n = 0;
+  int i;
+
+  for (i = 0; i < LATBUCKETS; i++)
+    n += hist[i];
+  printf("%s:  p50 %f  p99 %f  p99.9 %f  max %f  mean %f (%ld)\n", what,
+         percentile(hist, 0.5, max), percentile(hist, 0.99, max), percentile(hist, 0.999, max),
+         max, n > 0 ? total / n : 0.0, n);
+}
+
+/********************* PAYLOAD BUFFER POOL ***********/
+static char *getbuf(void)
+{
+  char *buf;
+
+  if (freebufs != NULL) {
+    buf = freebufs;
+    freebufs = *(char **)buf;
+    return buf;
+  }
+  buf = malloc(mtu < (int)sizeof(char *) ? sizeof(char *) : (size_t)mtu);
+  if (buf == 0) {
+    printf("memory allocation for payload failed.");
+    exit(EXIT_FAILURE);
+  }
+  nbufs++;
+  return buf;
+}
+
+static void putbuf(char *buf)
+{
+  if (buf == NULL)
+    return;
+  *(char **)buf = freebufs;
+  freebufs = buf;
+}
+
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+static int evbefore(struct event *a, struct event *b)
+{
+  if (a->evtime != b->evtime)
+    return a->evtime < b->evtime;
+  if (nthreads == 0 && !lporder)
+    return a->evseq > b->evseq;
+  return a->evseq < b->evseq || (a->evseq == b->evseq && a->evsource < b->evsource);
+}
+
+static void evput(int i, struct event *p)
+{
+  evheap[i] = p;
+  p->heappos = i;
+}
+
+/* move the event at heap index i to where the time order wants it */
+static void evsift(int i)
+{
+  struct event *p = evheap[i];
+  int child;
+
+  while (i > 0 && evbefore(p, evheap[(i - 1) / 2])) {
+    evput(i, evheap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= nevents)
+      break;
+    if (child + 1 < nevents && evbefore(evheap[child + 1], evheap[child]))
+      child++;
+    if (!evbefore(evheap[child], p))
+      break;
+    evput(i, evheap[child]);
+    i = child;
+  }
+  evput(i, p);
+}
+
+/* put p on the event list in the place its evseq gives it */
+static void evpush(struct event *p)
+{
+  if (nevents == evcap) {
+    evcap = 2 * evcap + 64;
+    evheap = realloc(evheap, evcap * sizeof(struct event *));
+    if (evheap == NULL) {
+      printf("memory allocation for the event list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  evput(nevents++, p);
+  evsift(p->heappos);
+  if (nevents > evhighwater)
+    evhighwater = nevents;
+}
+
+void insertevent(struct event *p)
+{
+  if (TRACE>2) {
+    printf("            INSERTEVENT: time is %f\n",time);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  p->evseq = evinserted++;
+  p->evsource = lpid;
+  if (lpid >= 0 && nthreads > 0 && p->evtype != FROM_LAYER5 && lpnode(p) != lpid) {
+    lpsend(p);                  /* it happens in another logical process */
+    return;
+  }
+  evpush(p);
+}
+
+/* take event p off the event list */
+static void removeevent(struct event *p)
+{
+  int i = p->heappos;
+
+  if (i != --nevents) {
+    evput(i, evheap[nevents]);
+    evsift(i);
+  }
+}
+
+void generate_next_arrival(void)
+{
+  double x;
+  struct event *evptr;
+
+  if (TRACE>2)
+    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+ 
+  rngstream = lpid >= 0;    /* the parallel engine keeps a stream for arrivals */
+  drawing = LOG_ARRIVAL;
+  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  /* having mean of lambda        */
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime =  time + x;
+  evptr->evtype =  FROM_LAYER5;
+  if (bidirectional && (jimsrand()>0.5) )
+    evptr->eventity = B;
+  else
+    evptr->eventity = A;
+  evptr->evflow = 0;
+  if (nflows > 1)   /* spread the offered load evenly over the flows */
+    evptr->evflow = (int)(jimsrand() * nflows) % nflows;
+  evptr->pktptr = NULL;
+  rngstream = 0;
+  drawing = LOG_CHANNEL;
+  insertevent(evptr);
+} 
+
+void printevlist(void)
+{
+  struct event *q;
+  int i;
+  printf("--------------\nEvent List Follows (in heap order):\n");
+  for(i = 0; i < nevents; i++) {
+    q = evheap[i];
+    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  }
+  printf("--------------\n");
+}
+
+/* an option for the direction from AorB: name_ab or name_ba before name */
+static const char *diroptionstr(const char *name, int AorB, const char *defval)
+{
+  char dirname[32];
+
+  sprintf(dirname, "%.20s_%s", name, AorB == A ? "ab" : "ba");
+  return getoptionstr(dirname, getoptionstr(name, defval));
+}
+
+static double diroption(const char *name, int AorB, double defval)
+{
+  const char *value = diroptionstr(name, AorB, NULL);
+
+  return value != NULL ? atof(value) : defval;
+}
+
+/* every flow's DRR quantum from quantum= and quanta= */
+static void quantainit(void)
+{
+  const char *list = getoptionstr("quanta", "");
+  char *end;
+  int quantum = (int)getoption("quantum", headersize + mtu);
+  int i;
+
+  quanta = malloc(nflows * sizeof(int));
+  if (quanta == NULL) {
+    printf("memory allocation for flow quanta failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nflows; i++) {
+    quanta[i] = quantum;
+    if (*list != '\0') {
+      quanta[i] = (int)strtol(list, &end, 10);
+      list = *end == ',' ? end + 1 : end;
+    }
+    if (quanta[i] < 1) {
+      printf("the DRR quantum of flow %d must be at least 1 byte\n", i);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* give link l the scheduler named sched */
+static void schedinit(struct link *l, const char *sched)
+{
+  if (strcmp(sched, "drr") == 0)
+    l->sched = QUEUE_DRR;
+  else if (strcmp(sched, "fifo") == 0)
+    l->sched = QUEUE_FIFO;
+  else {
+    printf("unknown scheduler %s.", sched);
+    exit(EXIT_FAILURE);
+  }
+  if (l->sched == QUEUE_DRR) {
+    l->flows = calloc(nflows, sizeof(struct flowqueue));
+    l->active = malloc(nflows * sizeof(int));
+    if (l->flows == NULL || l->active == NULL) {
+      printf("memory allocation for link queue failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void linkinit(int AorB)
+{
+  struct link *l = &links[AorB];
+  const char *aqm = diroptionstr("aqm", AorB, "droptail");
+  const char *sched = diroptionstr("sched", AorB, "fifo");
+  double unit;
+
+  memset(l, 0, sizeof(*l));
+  l->node = AorB;
+  l->rate = diroption("linkrate", AorB, 0);
+  l->delay = diroption("linkdelay", AorB, 1);
+  l->limit = (int)diroption("linkqueue", AorB, 0);
+  l->bytes = strcmp(diroptionstr("queueunit", AorB, "packets"), "bytes") == 0;
+  if (strcmp(aqm, "red") == 0)
+    l->aqm = AQM_RED;
+  else if (strcmp(aqm, "codel") == 0)
+    l->aqm = AQM_CODEL;
+  else if (strcmp(aqm, "droptail") == 0)
+    l->aqm = AQM_DROPTAIL;
+  else {
+    printf("unknown queue management %s.", aqm);
+    exit(EXIT_FAILURE);
+  }
+  schedinit(l, sched);
+  unit = l->bytes ? headersize + mtu : 1;
+  l->minth = diroption("redmin", AorB, l->limit > 0 ? l->limit / 4.0 : 5 * unit);
+  l->maxth = diroption("redmax", AorB, 3 * l->minth);
+  l->maxp = diroption("redmaxp", AorB, 0.1);
+  l->weight = diroption("redweight", AorB, 0.002);
+  l->redcount = -1;
+  l->target = diroption("codeltarget", AorB, 1.0);
+  l->interval = diroption("codelinterval", AorB, 16.0);
+}
+
+/* bring the occupancy integrals up to the current time */
+static void linkoccupancy(struct link *l)
+{
+  l->area += (time - l->changed) * (l->count + (l->sending > 0));
+  l->areabytes += (time - l->changed) * (l->qbytes + l->sending);
+  l->changed = time;
+}
+
+static void linkhighwater(struct link *l)
+{
+  if (l->count + (l->sending > 0) > l->maxpackets)
+    l->maxpackets = l->count + (l->sending > 0);
+  if (l->qbytes + l->sending > l->maxbytes)
+    l->maxbytes = l->qbytes + l->sending;
+}
+
+/* RED: update the average queue and decide whether to drop an arrival */
+static int red_drop(struct link *l)
+{
+  double q = l->bytes ? l->qbytes + l->sending : l->count + (l->sending > 0);
+  double pb;
+
+  if (l->idlesince >= 0)   /* age the average as if small packets had been sent while idle */
+    l->avg *= pow(1 - l->weight, (time - l->idlesince) * l->rate / (8.0 * headersize));
+  else
+    l->avg += l->weight * (q - l->avg);
+  if (l->avg < l->minth) {
+    l->redcount = -1;
+    return 0;
+  }
+  if (l->avg >= l->maxth) {
+    l->redcount = 0;
+    return 1;
+  }
+  l->redcount++;
+  pb = l->maxp * (l->avg - l->minth) / (l->maxth - l->minth);
+  if (l->redcount * pb >= 1 || jimsrand() < pb / (1 - l->redcount * pb)) {
+    l->redcount = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/* whether a packet of size bytes may join the queue of the link from AorB */
+static int linkadmit(int AorB, int size)
+{
+  struct link *l = &links[AorB];
+
+  linkoccupancy(l);
+  if (l->limit > 0 && (l->bytes ? l->qbytes + l->sending + size
+                                : l->count + (l->sending > 0) + 1) > l->limit) {
+    l->drops++;
+    if (TRACE>0)
+      printf("          TOLAYER3: link queue full, packet dropped\n");
+    return 0;
+  }
+  if (l->aqm == AQM_RED && red_drop(l)) {
+    l->aqmdrops++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet dropped early by RED\n");
+    return 0;
+  }
+  return 1;
+}
+
+static void freeevent(struct event *ev)
+{
+  if (ev == NULL)
+    return;
+  putbuf(ev->pktptr->payload);
+  free(ev->pktptr);
+  free(ev);
+}
+
+static void ringpush(struct pktring *q, struct linkentry *e)
+{
+  struct linkentry *entries;
+  int i;
+
+  if (q->count == q->cap) {
+    /* grow the ring, unrolling it so the oldest packet is first */
+    entries = malloc(2 * (q->cap + 8) * sizeof(struct linkentry));
+    if (entries == NULL) {
+      printf("memory allocation for link queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < q->count; i++)
+      entries[i] = q->entries[(q->head + i) % q->cap];
+    free(q->entries);
+    q->entries = entries;
+    q->head = 0;
+    q->cap = 2 * (q->cap + 8);
+  }
+  q->entries[(q->head + q->count) % q->cap] = *e;
+  q->count++;
+}
+
+static void ringpop(struct pktring *q, struct linkentry *e)
+{
+  *e = q->entries[q->head];
+  q->head = (q->head + 1) % q->cap;
+  q->count--;
+}
+
+/* DRR (Shreedhar and Varghese): serve the flow at the front of the active */
+/* ring if its deficit covers its head packet, otherwise send it to the    */
+/* back with another quantum to come.  With quanta of at least one packet  */
+/* each flow sends on its first turn, so a packet costs O(1) however many  */
+/* flows there are.                                                        */
+static int drr_pop(struct link *l, struct linkentry *e)
+{
+  struct flowqueue *f;
+  int flow;
+
+  while (l->nactive > 0) {
+    flow = l->active[l->firstactive];
+    f = &l->flows[flow];
+    if (f->fresh) {
+      f->deficit += quanta[flow];
+      f->fresh = 0;
+    }
+    if (f->ring.entries[f->ring.head].size <= f->deficit) {
+      ringpop(&f->ring, e);
+      f->deficit -= e->size;
+      if (f->ring.count == 0) {   /* an idle flow keeps no credit */
+        f->deficit = 0;
+        f->fresh = 1;
+        l->firstactive = (l->firstactive + 1) % nflows;
+        l->nactive--;
+      }
+      return 1;
+    }
+    f->fresh = 1;
+    l->active[(l->firstactive + l->nactive) % nflows] = flow;
+    l->firstactive = (l->firstactive + 1) % nflows;
+  }
+  return 0;
+}
+
+/* take the next packet to send off the queue; 0 if there is none */
+static int linkpop(struct link *l, struct linkentry *e)
+{
+  if (l->count == 0)
+    return 0;
+  if (l->sched == QUEUE_DRR)
+    drr_pop(l, e);
+  else
+    ringpop(&l->fifo, e);
+  l->count--;
+  l->qbytes -= e->size;
+  return 1;
+}
+
+/* CoDel's dequeue step (RFC 8289): take the head packet and note whether */
+/* it has been above target for long enough that it may be dropped        */
+static int codel_dodequeue(struct link *l, struct linkentry *e, int *oktodrop)
+{
+  *oktodrop = 0;
+  if (!linkpop(l, e)) {
+    l->first_above = 0;
+    return 0;
+  }
+  if (time - e->enqueued < l->target || l->qbytes <= headersize + mtu)
+    l->first_above = 0;
+  else if (l->first_above == 0)
+    l->first_above = time + l->interval;
+  else if (time >= l->first_above)
+    *oktodrop = 1;
+  return 1;
+}
+
+static void codel_drop(struct link *l, struct linkentry *e)
+{
+  l->aqmdrops++;
+  freeevent(e->ev);
+  if (TRACE>0)
+    printf("          LINK: packet dropped by CoDel after waiting %f\n", time - e->enqueued);
+}
+
+/* CoDel: the next packet to transmit, dropping those CoDel's control law */
+/* calls for; 0 if the queue runs empty                                   */
+static int codel_dequeue(struct link *l, struct linkentry *e)
+{
+  int oktodrop, delta;
+  int got = codel_dodequeue(l, e, &oktodrop);
+
+  if (l->dropping) {
+    if (!oktodrop)
+      l->dropping = 0;
+    while (l->dropping && time >= l->drop_next) {
+      codel_drop(l, e);
+      l->dropcount++;
+      got = codel_dodequeue(l, e, &oktodrop);
+      if (!oktodrop)
+        l->dropping = 0;
+      else
+        l->drop_next += l->interval / sqrt(l->dropcount);
+    }
+  } else if (oktodrop) {
+    codel_drop(l, e);
+    got = codel_dodequeue(l, e, &oktodrop);
+    l->dropping = 1;
+    /* start near the drop rate that last controlled the queue */
+    delta = l->dropcount - l->lastcount;
+    l->dropcount = 1;
+    if (delta > 1 && time - l->drop_next < 16 * l->interval)
+      l->dropcount = delta;
+    l->drop_next = time + l->interval / sqrt(l->dropcount);
+    l->lastcount = l->dropcount;
+  }
+  return got;
+}
+
+/* start transmitting the next queued packet on the link from AorB, if any */
+static void linkstart(int AorB)
+{
+  struct link *l = &links[AorB];
+  struct linkentry e;
+  struct event *done;
+  double tx, wait;
+  int got = l->aqm == AQM_CODEL ? codel_dequeue(l, &e) : linkpop(l, &e);
+
+  if (!got) {
+    l->idlesince = time;
+    return;
+  }
+  tx = 8.0 * e.size / l->rate;
+  wait = time - e.enqueued;
+  l->sojourn += wait;
+  if (wait > l->maxsojourn)
+    l->maxsojourn = wait;
+  l->sending = e.size;
+  l->busy += tx;
+  l->sent++;
+  if (e.ev != NULL) {
+    e.ev->evtime = time + tx + l->delay;
+    insertevent(e.ev);
+  }
+
+  /* tell the link when the packet has left */
+  done = malloc(sizeof(struct event));
+  if (done == NULL) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  done->evtime = time + tx;
+  done->evtype = LINK_DONE;
+  done->eventity = AorB;
+  done->evnode = l->node;
+  done->pktptr = NULL;
+  insertevent(done);
+}
+
+/* queue a packet of size bytes of connection connid on the link from    */
+/* AorB; ev is its arrival at the other side, or NULL if the medium will */
+/* lose it                                                               */
+static void linkenqueue(int AorB, struct event *ev, int size, int connid)
+{
+  struct link *l = &links[AorB];
+  struct linkentry e;
+  struct flowqueue *f;
+
+  linkoccupancy(l);
+  e.ev = ev;
+  e.size = size;
+  e.enqueued = time;
+  if (l->sched == QUEUE_DRR) {
+    if (connid < 0 || connid >= nflows)
+      connid = 0;
+    f = &l->flows[connid];
+    if (f->ring.count == 0) {   /* the flow joins the back of the round */
+      l->active[(l->firstactive + l->nactive) % nflows] = connid;
+      l->nactive++;
+      if (l->nactive > l->maxactive)
+        l->maxactive = l->nactive;
+      f->fresh = 1;
+    }
+    ringpush(&f->ring, &e);
+  } else
+    ringpush(&l->fifo, &e);
+  l->count++;
+  l->qbytes += size;
+  l->idlesince = -1;
+  if (l->sending == 0)
+    linkstart(AorB);
+  linkhighwater(l);
+}
+
+/* the link from AorB has finished sending a packet */
+static void linkdone(int AorB)
+{
+  struct link *l = &links[AorB];
+
+  linkoccupancy(l);
+  l->sending = 0;
+  linkstart(AorB);
+}
+
+static void linkreport(int id, const char *name)
+{
+  struct link *l = &links[id];
+  static const char *aqmnames[] = {"droptail", "RED", "CoDel"};
+
+  linkoccupancy(l);
+  printf("link %s: %d packets sent, %d dropped by the full queue, utilisation %.2f%%\n",
+         name, l->sent, l->drops, time > 0 ? 100.0 * l->busy / time : 0.0);
+  if (l->aqm != AQM_DROPTAIL)
+    printf("  packets dropped by %s:  %d\n", aqmnames[l->aqm], l->aqmdrops);
+  printf("  queue occupancy: mean %f packets (%f bytes), max %d packets (%d bytes)\n",
+         time > 0 ? l->area / time : 0.0, time > 0 ? l->areabytes / time : 0.0,
+         l->maxpackets, l->maxbytes);
+  printf("  time waiting in the queue: mean %f, max %f\n",
+         l->sent > 0 ? l->sojourn / l->sent : 0.0, l->maxsojourn);
+  if (l->sched == QUEUE_DRR)
+    printf("  served by DRR, at most %d of %d flows backlogged at once\n", l->maxactive, nflows);
+}
+
+/* loss models.  Each direction draws its losses from the model named by  */
+/* loss= (or loss_ab=, loss_ba=): bernoulli loses packets independently   */
+/* with the probability entered at the prompt, ge is a two-state          */
+/* Gilbert-Elliott channel, trace replays the '0' (delivered) and '1'      */
+/* (lost) characters of the file losstrace= names, and none loses nothing. */
+/* Loss only happens in the direction(s) chosen at the prompt.            */
+struct lossmodel {
+  const struct lossops *ops;
+  double prob;            /* bernoulli: loss probability */
+  double p, r;            /* ge: good to bad and bad to good transition probabilities */
+  double good, bad;       /* ge: loss probability in each state */
+  int inbad;              /* ge: in the bad state */
+  const char *trace;      /* trace: the mapped file */
+  long tracelen, tracepos;
+  int offered;            /* packets the model was asked about */
+  int lost;
+  int bursts;             /* runs of consecutive losses */
+  int run, maxrun;        /* current and longest run */
+};
+
+struct lossops {
+  const char *name;
+  void (*init)(struct lossmodel *, int AorB);
+  int (*lose)(struct lossmodel *);    /* whether the next packet is lost */
+};
+
+static struct lossmodel losses[2];  /* indexed by sender, like links */
+
+static void bernoulli_init(struct lossmodel *m, int AorB)
+{
+  m->prob = diroption("lossprob", AorB, lossprob);
+}
+
+static int bernoulli_lose(struct lossmodel *m)
+{
+  return jimsrand() < m->prob;
+}
+
+/* by default the bad state lasts 4 packets on average and the long run */
+/* loss rate equals the loss probability entered at the prompt          */
+static void ge_init(struct lossmodel *m, int AorB)
+{
+  m->r = diroption("ger", AorB, 0.25);
+  m->p = diroption("gep", AorB, lossprob < 1 ? m->r * lossprob / (1 - lossprob) : 1);
+  m->good = diroption("gegood", AorB, 0);
+  m->bad = diroption("gebad", AorB, 1);
+  m->inbad = 0;
+}
+
+static int ge_lose(struct lossmodel *m)
+{
+  int lost = jimsrand() < (m->inbad ? m->bad : m->good);
+
+  if (jimsrand() < (m->inbad ? m->r : m->p))
+    m->inbad = !m->inbad;
+  return lost;
+}
+
+static void trace_init(struct lossmodel *m, int AorB)
+{
+  const char *name = diroptionstr("losstrace", AorB, NULL);
+  struct stat st;
+  void *map;
+  int fd;
+
+  if (name == NULL) {
+    printf("loss=trace needs a losstrace= file.");
+    exit(EXIT_FAILURE);
+  }
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+    printf("cannot read loss trace %s.", name);
+    exit(EXIT_FAILURE);
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    printf("cannot map loss trace %s.", name);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  if (memchr(map, '0', st.st_size) == NULL && memchr(map, '1', st.st_size) == NULL) {
+    printf("loss trace %s has no 0 or 1 in it.", name);
+    exit(EXIT_FAILURE);
+  }
+  m->trace = map;
+  m->tracelen = st.st_size;
+  m->tracepos = 0;
+}
+
+/* the next '0' or '1' in the trace, starting over at its end */
+static int trace_lose(struct lossmodel *m)
+{
+  long i;
+  char c;
+
+  for (i = 0; i < m->tracelen; i++) {
+    c = m->trace[m->tracepos];
+    m->tracepos = (m->tracepos + 1) % m->tracelen;
+    if (c == '0' || c == '1')
+      return c == '1';
+  }
+  return 0;   /* not reached: trace_init made sure there is an outcome */
+}
+
+static void none_init(struct lossmodel *m, int AorB)
+{
+  (void)m;
+  (void)AorB;
+}
+
+static int none_lose(struct lossmodel *m)
+{
+  (void)m;
+  return 0;
+}
+
+static const struct lossops lossmodels[] = {
+  {"bernoulli", bernoulli_init, bernoulli_lose},
+  {"ge", ge_init, ge_lose},
+  {"trace", trace_init, trace_lose},
+  {"none", none_init, none_lose},
+};
+
+static void lossinit(int AorB)
+{
+  struct lossmodel *m = &losses[AorB];
+  const char *name = diroptionstr("loss", AorB, "bernoulli");
+  int i;
+
+  memset(m, 0, sizeof(*m));
+  for (i = 0; i < (int)(sizeof(lossmodels) / sizeof(lossmodels[0])); i++)
+    if (strcmp(lossmodels[i].name, name) == 0)
+      m->ops = &lossmodels[i];
+  if (m->ops == NULL) {
+    printf("unknown loss model %s.", name);
+    exit(EXIT_FAILURE);
+  }
+  m->ops->init(m, AorB);
+}
+
+/* record whether the packet the model was asked about was lost */
+static int losscount(struct lossmodel *m, int lost)
+{
+  m->offered++;
+  if (lost) {
+    m->lost++;
+    if (m->run++ == 0)
+      m->bursts++;
+    if (m->run > m->maxrun)
+      m->maxrun = m->run;
+  } else
+    m->run = 0;
+  return lost;
+}
+
+/* whether the medium loses the packet AorB is sending.  The model is */
+/* consulted even where loss is switched off, so the random number    */
+/* sequence does not depend on the direction                          */
+static int lossdraw(int AorB)
+{
+  struct lossmodel *m = &losses[AorB];
+  int lost = m->ops->lose(m);
+
+  if (corruptdirection == (AorB + 1) % 2)
+    return 0;   /* loss only in the other direction */
+  return losscount(m, lost);
+}
+
+static void lossreport(struct lossmodel *m, const char *name)
+{
+  printf("loss %s (%s): %d of %d packets lost, mean loss burst %f packets, longest %d\n",
+         name, m->ops->name, m->lost, m->offered,
+         m->bursts > 0 ? (double)m->lost / m->bursts : 0.0, m->maxrun);
+}
+
+/* delay models for the original channel (no linkrate).  delay= (or        */
+/* delay_ab=, delay_ba=) picks the distribution of the time a packet takes */
+/* to cross the medium: uniform between delaymin and delaymax (1 and 10,   */
+/* as before), constant delaymean, exponential or pareto with mean         */
+/* delaymean and at least delaymin, or cdf, drawn from the empirical CDF   */
+/* in the file delaycdf= names.  Packets arrive that delay after the last  */
+/* one already in flight, so the medium keeps them in order, except that   */
+/* with probability reorder a packet's delay counts from when it was sent  */
+/* and it may overtake those in flight.                                    */
+struct delaymodel {
+  const struct delayops *ops;
+  double min, max, mean;
+  double shape;           /* pareto: tail index */
+  double *values, *probs; /* cdf: points of the distribution, in order */
+  int npoints;
+  double reorder;         /* probability of ignoring the packets in flight */
+  int samples;
+  double total;           /* sum of the delays drawn */
+  int reordered;          /* packets that overtook one sent before them */
+};
+
+struct delayops {
+  const char *name;
+  void (*init)(struct delaymodel *, int AorB);
+  double (*sample)(struct delaymodel *);
+  double (*least)(struct delaymodel *);   /* the shortest delay it can draw */
+};
+
+static struct delaymodel delays[2];     /* indexed by sender, like links */
+
+/* uniform in (0,1], for inverting distributions with a pole at 0 */
+static double openrand(void)
+{
+  double x = 1 - jimsrand();
+
+  return x > 1e-12 ? x : 1e-12;
+}
+
+static void delayparams(struct delaymodel *m, int AorB)
+{
+  m->min = diroption("delaymin", AorB, 1);
+  m->max = diroption("delaymax", AorB, 10);
+  m->mean = diroption("delaymean", AorB, 5.5);
+  m->shape = diroption("delayshape", AorB, 2.5);
+  if (m->min < 0) {
+    printf("delaymin must not be negative.");
+    exit(EXIT_FAILURE);
+  }
+  if (strcmp(m->ops->name, "uniform") == 0 && m->max < m->min) {
+    printf("delaymax must not be less than delaymin.");
+    exit(EXIT_FAILURE);
+  }
+  /* at or below 1 the Pareto mean is infinite and there is no scale for it */
+  if (strcmp(m->ops->name, "pareto") == 0 && m->shape <= 1) {
+    printf("delayshape must be greater than 1.");
+    exit(EXIT_FAILURE);
+  }
+  if ((strcmp(m->ops->name, "exponential") == 0 || strcmp(m->ops->name, "pareto") == 0) &&
+      m->mean < m->min) {
+    printf("delaymean must not be less than delaymin.");
+    exit(EXIT_FAILURE);
+  }
+  if (strcmp(m->ops->name, "constant") == 0 && m->mean < 0) {
+    printf("delaymean must not be negative.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static double uniform_delay(struct delaymodel *m)
+{
+  return m->min + (m->max - m->min) * jimsrand();
+}
+
+static double constant_delay(struct delaymodel *m)
+{
+  return m->mean;
+}
+
+static double exponential_delay(struct delaymodel *m)
+{
+  return m->min - (m->mean - m->min) * log(openrand());
+}
+
+/* heavy tailed: the part above delaymin is Pareto with the given shape */
+static double pareto_delay(struct delaymodel *m)
+{
+  double scale = (m->mean - m->min) * (m->shape - 1) / m->shape;
+
+  return m->min + scale * pow(openrand(), -1 / m->shape);
+}
+
+/* the file holds "delay probability" lines, each probability the chance */
+/* of a delay up to that value; samples interpolate between the lines    */
+static void cdf_init(struct delaymodel *m, int AorB)
+{
+  const char *name = diroptionstr("delaycdf", AorB, NULL);
+  FILE *f;
+  double value, prob;
+  int cap = 0;
+
+  delayparams(m, AorB);
+  if (name == NULL || (f = fopen(name, "r")) == NULL) {
+    printf("delay=cdf needs a readable delaycdf= file.");
+    exit(EXIT_FAILURE);
+  }
+  while (fscanf(f, "%lf %lf", &value, &prob) == 2) {
+    if (m->npoints == cap) {
+      cap = 2 * cap + 16;
+      m->values = realloc(m->values, cap * sizeof(double));
+      m->probs = realloc(m->probs, cap * sizeof(double));
+      if (m->values == NULL || m->probs == NULL) {
+        printf("memory allocation for delay distribution failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (value < 0) {
+      printf("delay distribution %s has a negative delay.", name);
+      exit(EXIT_FAILURE);
+    }
+    if (m->npoints > 0 && (value < m->values[m->npoints - 1] || prob < m->probs[m->npoints - 1])) {
+      printf("delay distribution %s is not in increasing order.", name);
+      exit(EXIT_FAILURE);
+    }
+    m->values[m->npoints] = value;
+    m->probs[m->npoints] = prob;
+    m->npoints++;
+  }
+  fclose(f);
+  if (m->npoints == 0) {
+    printf("delay distribution %s is empty.", name);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static double cdf_delay(struct delaymodel *m)
+{
+  double u = jimsrand();
+  int i = 0;
+
+  while (i < m->npoints - 1 && m->probs[i] < u)
+    i++;
+  if (i == 0 || m->probs[i] == m->probs[i - 1])
+    return m->values[i];
+  return m->values[i - 1] + (m->values[i] - m->values[i - 1]) *
+         (u - m->probs[i - 1]) / (m->probs[i] - m->probs[i - 1]);
+}
+
+static double delaymin_least(struct delaymodel *m)
+{
+  return m->min;
+}
+
+static double delaymean_least(struct delaymodel *m)
+{
+  return m->mean;
+}
+
+static double cdf_least(struct delaymodel *m)
+{
+  return m->values[0];
+}
+
+static const struct delayops delaymodels[] = {
+  {"uniform", delayparams, uniform_delay, delaymin_least},
+  {"constant", delayparams, constant_delay, delaymean_least},
+  {"exponential", delayparams, exponential_delay, delaymin_least},
+  {"pareto", delayparams, pareto_delay, delaymin_least},
+  {"cdf", cdf_init, cdf_delay, cdf_least},
+};
+
+static void delayinit(int AorB)
+{
+  struct delaymodel *m = &delays[AorB];
+  const char *name = diroptionstr("delay", AorB, "uniform");
+  int i;
+
+  memset(m, 0, sizeof(*m));
+  for (i = 0; i < (int)(sizeof(delaymodels) / sizeof(delaymodels[0])); i++)
+    if (strcmp(delaymodels[i].name, name) == 0)
+      m->ops = &delaymodels[i];
+  if (m->ops == NULL) {
+    printf("unknown delay distribution %s.", name);
+    exit(EXIT_FAILURE);
+  }
+  m->ops->init(m, AorB);
+  m->reorder = diroption("reorder", AorB, 0);
+}
+
+static void delayreport(int AorB)
+{
+  struct delaymodel *m = &delays[AorB];
+
+  printf("delay %s (%s): mean %f over %d packets, %d packets overtook an earlier one\n",
+         AorB == A ? "A->B" : "B->A", m->ops->name,
+         m->samples > 0 ? m->total / m->samples : 0.0, m->samples, m->reordered);
+}
+
+/* whether a delay distribution or reordering was asked for */
+static int delayset(void)
+{
+  return getoptionstr("delay", NULL) != NULL || getoptionstr("delay_ab", NULL) != NULL ||
+         getoptionstr("delay_ba", NULL) != NULL || getoption("reorder", 0) > 0 ||
+         getoption("reorder_ab", 0) > 0 || getoption("reorder_ba", 0) > 0;
+}
+
+/* multi-hop topology.  topology= names a file describing the routers      */
+/* between A and B, the links joining them and static routes, e.g.        */
+/*     router r1                                                            */
+/*     link A r1 rate=8000 delay=1                                          */
+/*     link r1 B rate=2000 delay=5 queue=20 loss=0.01                       */
+/*     route r1 A A                                                         */
+/* Each link line joins two nodes with a store-and-forward link each way,  */
+/* like the one linkrate= gives, with its own rate, delay, queue (packets, */
+/* 0 for no limit), sched, and loss: a probability, or gep, ger, gegood    */
+/* and gebad for Gilbert-Elliott.  route <node> <endpoint> <via> sends the */
+/* packets node has for that endpoint on to via; a node with a link to     */
+/* the endpoint itself, or with only one link, needs no route.  Packets    */
+/* are still corrupted once, as they are sent; the prompt's loss and the   */
+/* single-hop channel options (linkrate, loss, delay, scenario) do not     */
+/* apply.                                                                  */
+struct hop {
+  int from, to;           /* nodes */
+  struct lossmodel loss;
+};
+
+static char **nodenames;          /* A, B, then the routers */
+static int nnodes;
+static struct hop *hops;          /* hops[i] is sent on by links[2 + i] */
+static int nhops;
+static int (*routes)[2];          /* hop each node sends packets for A and for B on, -1 if none */
+static LPLOCAL long forwarded;            /* packets passed on by routers */
+
+static int nodeid(const char *name)
+{
+  int i;
+
+  for (i = 0; i < nnodes; i++)
+    if (strcmp(nodenames[i], name) == 0)
+      return i;
+  return -1;
+}
+
+static void addnode(const char *file, int line, const char *name)
+{
+  char *copy = malloc(strlen(name) + 1);
+
+  if (nodeid(name) >= 0) {
+    printf("%s:%d: node %s is already defined\n", file, line, name);
+    exit(EXIT_FAILURE);
+  }
+  nodenames = realloc(nodenames, (nnodes + 1) * sizeof(char *));
+  routes = realloc(routes, (nnodes + 1) * sizeof(*routes));
+  if (copy == NULL || nodenames == NULL || routes == NULL) {
+    printf("memory allocation for topology failed.");
+    exit(EXIT_FAILURE);
+  }
+  strcpy(copy, name);
+  nodenames[nnodes] = copy;
+  routes[nnodes][A] = routes[nnodes][B] = -1;
+  nnodes++;
+}
+
+/* the hop from node from to node to, -1 if they are not linked */
+static int hopbetween(int from, int to)
+{
+  int h;
+
+  for (h = 0; h < nhops; h++)
+    if (hops[h].from == from && hops[h].to == to)
+      return h;
+  return -1;
+}
+
+/* the node named by the next token of the line */
+static int nodetoken(const char *file, int line)
+{
+  char *token = strtok(NULL, " \t\r\n");
+  int n = token != NULL ? nodeid(token) : -1;
+
+  if (n < 0) {
+    printf("%s:%d: unknown node %s\n", file, line, token != NULL ? token : "(none)");
+    exit(EXIT_FAILURE);
+  }
+  return n;
+}
+
+/* the rest of a link line: the two nodes, then name=value settings */
+static void parselink(const char *file, int line)
+{
+  int from = nodetoken(file, line), to = nodetoken(file, line);
+  struct link l;
+  struct lossmodel m;
+  char *token, *value;
+  const char *sched = "fifo";
+  int i;
+
+  if (from == to || hopbetween(from, to) >= 0) {
+    printf("%s:%d: %s and %s cannot be linked again\n", file, line, nodenames[from], nodenames[to]);
+    exit(EXIT_FAILURE);
+  }
+  memset(&l, 0, sizeof(l));
+  l.delay = 1;
+  l.aqm = AQM_DROPTAIL;
+  l.redcount = -1;
+  memset(&m, 0, sizeof(m));
+  m.ops = &lossmodels[0];
+  m.r = 0.25;
+  m.bad = 1;
+  while ((token = strtok(NULL, " \t\r\n")) != NULL && token[0] != '#') {
+    value = strchr(token, '=');
+    if (value == NULL) {
+      printf("%s:%d: expected name=value, found %s\n", file, line, token);
+      exit(EXIT_FAILURE);
+    }
+    *value++ = '\0';
+    if (strcmp(token, "rate") == 0)
+      l.rate = atof(value);
+    else if (strcmp(token, "delay") == 0)
+      l.delay = atof(value);
+    else if (strcmp(token, "queue") == 0)
+      l.limit = atoi(value);
+    else if (strcmp(token, "sched") == 0)
+      sched = value;
+    else if (strcmp(token, "loss") == 0)
+      m.prob = atof(value);
+    else if (strcmp(token, "gep") == 0)
+      m.p = atof(value);
+    else if (strcmp(token, "ger") == 0)
+      m.r = atof(value);
+    else if (strcmp(token, "gegood") == 0)
+      m.good = atof(value);
+    else if (strcmp(token, "gebad") == 0)
+      m.bad = atof(value);
+    else {
+      printf("%s:%d: unknown link setting %s\n", file, line, token);
+      exit(EXIT_FAILURE);
+    }
+    if (strncmp(token, "ge", 2) == 0)
+      m.ops = &lossmodels[1];
+  }
+  if (l.rate <= 0) {
+    printf("%s:%d: a link needs a rate above 0\n", file, line);
+    exit(EXIT_FAILURE);
+  }
+  hops = realloc(hops, (nhops + 2) * sizeof(struct hop));
+  links = realloc(links, (2 + nhops + 2) * sizeof(struct link));
+  if (hops == NULL || links == NULL) {
+    printf("memory allocation for topology failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < 2; i++) {
+    hops[nhops].from = i == 0 ? from : to;
+    hops[nhops].to = i == 0 ? to : from;
+    hops[nhops].loss = m;
+    links[2 + nhops] = l;
+    links[2 + nhops].node = hops[nhops].from;
+    schedinit(&links[2 + nhops], sched);
+    nhops++;
+  }
+}
+
+/* follow the routes from node from to endpoint to, failing on a gap or loop */
+static void checkroute(int from, int to)
+{
+  int node = from, steps;
+
+  for (steps = 0; node != to; steps++) {
+    if (routes[node][to] < 0) {
+      printf("topology: no route from %s to %s\n", nodenames[node], nodenames[to]);
+      exit(EXIT_FAILURE);
+    }
+    if (steps == nnodes) {
+      printf("topology: the route from %s to %s loops\n", nodenames[from], nodenames[to]);
+      exit(EXIT_FAILURE);
+    }
+    node = hops[routes[node][to]].to;
+  }
+}
+
+static void topologyinit(void)
+{
+  const char *file = getoptionstr("topology", NULL);
+  char buf[256], *token;
+  FILE *f;
+  int line = 0, node, to, via, h, n, only;
+
+  links = calloc(2, sizeof(struct link));
+  if (links == NULL) {
+    printf("memory allocation for links failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (file == NULL)
+    return;
+  f = fopen(file, "r");
+  if (f == NULL) {
+    printf("cannot read topology %s.", file);
+    exit(EXIT_FAILURE);
+  }
+  addnode(file, 0, "A");
+  addnode(file, 0, "B");
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    line++;
+    token = strtok(buf, " \t\r\n");
+    if (token == NULL || token[0] == '#')
+      continue;
+    if (strcmp(token, "router") == 0) {
+      token = strtok(NULL, " \t\r\n");
+      if (token == NULL) {
+        printf("%s:%d: expected router <name>\n", file, line);
+        exit(EXIT_FAILURE);
+      }
+      addnode(file, line, token);
+    } else if (strcmp(token, "link") == 0)
+      parselink(file, line);
+    else if (strcmp(token, "route") == 0) {
+      node = nodetoken(file, line);
+      to = nodetoken(file, line);
+      via = nodetoken(file, line);
+      if (to != A && to != B) {
+        printf("%s:%d: routes lead to A or B, not %s\n", file, line, nodenames[to]);
+        exit(EXIT_FAILURE);
+      }
+      if ((h = hopbetween(node, via)) < 0) {
+        printf("%s:%d: %s has no link to %s\n", file, line, nodenames[node], nodenames[via]);
+        exit(EXIT_FAILURE);
+      }
+      routes[node][to] = h;
+    } else {
+      printf("%s:%d: expected router, link or route, found %s\n", file, line, token);
+      exit(EXIT_FAILURE);
+    }
+  }
+  fclose(f);
+
+  /* routes not given: straight to the endpoint, or over a node's only link */
+  for (node = 0; node < nnodes; node++)
+    for (to = A; to <= B; to++) {
+      if (routes[node][to] >= 0 || node == to)
+        continue;
+      routes[node][to] = hopbetween(node, to);
+      for (h = 0, n = 0, only = -1; h < nhops; h++)
+        if (hops[h].from == node) {
+          n++;
+          only = h;
+        }
+      if (routes[node][to] < 0 && n == 1)
+        routes[node][to] = only;
+    }
+  checkroute(A, B);
+  checkroute(B, A);
+}
+
+/* send the packet of ev on from node towards ev->eventity over the routed */
+/* hop; it may be dropped at the queue or lost on the way                  */
+static void forward(int node, struct event *ev)
+{
+  int h = routes[node][ev->eventity];
+  struct lossmodel *m = &hops[h].loss;
+  int size = headersize + (ev->pktptr->length > 0 ? ev->pktptr->length : 0);
+  int connid = ev->pktptr->connid;
+
+  if (TRACE>2 && node != A && node != B)
+    printf("          ROUTER %s: forwarding to %s\n", nodenames[node], nodenames[hops[h].to]);
+  if (!linkadmit(2 + h, size)) {
+    freeevent(ev);
+    return;
+  }
+  if (losscount(m, m->ops->lose(m))) {
+    nlost++;
+    byteslost += size;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost between %s and %s\n",
+             nodenames[node], nodenames[hops[h].to]);
+    freeevent(ev);
+    linkenqueue(2 + h, NULL, size, connid);   /* still uses the link */
+    return;
+  }
+  ev->evtype = hops[h].to == ev->eventity ? FROM_LAYER3 : ROUTER;
+  ev->evnode = hops[h].to;
+  linkenqueue(2 + h, ev, size, connid);
+}
+
+/* the hops packets were routed over, with their losses where they have any */
+static void topologyreport(void)
+{
+  struct lossmodel *m;
+  char name[64];
+  int h, unused = 0;
+
+  for (h = 0; h < nhops; h++)
+    unused += links[2 + h].sent == 0 && links[2 + h].drops == 0;
+  printf("topology: %d nodes, %d links, %ld packets forwarded by routers, %d hops unused\n",
+         nnodes, nhops / 2, forwarded, unused);
+  for (h = 0; h < nhops; h++) {
+    if (links[2 + h].sent == 0 && links[2 + h].drops == 0)
+      continue;
+    m = &hops[h].loss;
+    sprintf(name, "%.30s->%.30s", nodenames[hops[h].from], nodenames[hops[h].to]);
+    linkreport(2 + h, name);
+    if (m->ops != &lossmodels[0] || m->prob > 0)
+      lossreport(m, name);
+  }
+}
+
+/* scenarios.  scenario= names a file of timed changes to the channel, one */
+/* time per line followed by the changes to make then, e.g.                */
+/*     t=5000 loss=0.5 corrupt=0.1                                          */
+/*     t=8000 link down 200                                                 */
+/*     t=9000 rate=half                                                     */
+/* loss, rate, linkdelay, reorder, delaymin, delaymax and delaymean may     */
+/* end in _ab or _ba to change one direction; rate also takes half and     */
+/* double.  While a link is down every packet sent on it is lost.  The      */
+/* changes are applied by SCENARIO events, one pending at a time.          */
+#define SC_LOSS 0
+#define SC_CORRUPT 1
+#define SC_RATE 2
+#define SC_LINKDELAY 3
+#define SC_REORDER 4
+#define SC_DELAYMIN 5
+#define SC_DELAYMAX 6
+#define SC_DELAYMEAN 7
+#define SC_DOWN 8
+#define SC_UP 9
+
+struct change {
+  double at;
+  int line;               /* keeps changes at the same time in file order */
+  int what;
+  int dir;                /* A, B, or 2 for both directions */
+  double value;
+  int relative;           /* value multiplies the current setting */
+};
+
+static struct change *changes;
+static int nchanges, nextchange;
+static int linkdown[2];           /* packets sent in this direction are lost */
+static int outages;
+static double lastup = -1;        /* when a link last came back, -1 once something was delivered after */
+static double recovery_total, recovery_max;
+static int recoveries;
+static double interval;           /* goodput is also reported for each interval this long */
+static long *intervalbytes;
+static int nintervals;
+
+static const char *changenames[] = {"loss", "corrupt", "rate", "linkdelay", "reorder",
+                                    "delaymin", "delaymax", "delaymean"};
+
+static void addchange(double at, int line, int what, int dir, double value, int relative)
+{
+  if (nchanges % 16 == 0) {
+    changes = realloc(changes, (nchanges + 16) * sizeof(struct change));
+    if (changes == NULL) {
+      printf("memory allocation for scenario failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  changes[nchanges].at = at;
+  changes[nchanges].line = line;
+  changes[nchanges].what = what;
+  changes[nchanges].dir = dir;
+  changes[nchanges].value = value;
+  changes[nchanges].relative = relative;
+  nchanges++;
+}
+
+static int changeorder(const void *a, const void *b)
+{
+  const struct change *x = a, *y = b;
+
+  if (x->at != y->at)
+    return x->at < y->at ? -1 : 1;
+  return x->line - y->line;
+}
+
+/* parse one name=value change from line number line of the scenario */
+static void parsechange(const char *file, int line, double at, char *token)
+{
+  char *value = strchr(token, '=');
+  size_t len;
+  int dir = 2, what, relative = 0;
+  double v;
+
+  if (value == NULL) {
+    printf("%s:%d: expected name=value, found %s\n", file, line, token);
+    exit(EXIT_FAILURE);
+  }
+  *value++ = '\0';
+  len = strlen(token);
+  if (len > 3 && strcmp(token + len - 3, "_ab") == 0)
+    dir = A;
+  else if (len > 3 && strcmp(token + len - 3, "_ba") == 0)
+    dir = B;
+  if (dir != 2)
+    token[len - 3] = '\0';
+  for (what = 0; what < (int)(sizeof(changenames) / sizeof(changenames[0])); what++)
+    if (strcmp(token, changenames[what]) == 0)
+      break;
+  if (what == (int)(sizeof(changenames) / sizeof(changenames[0])) || (what == SC_CORRUPT && dir != 2)) {
+    printf("%s:%d: cannot change %s\n", file, line, token);
+    exit(EXIT_FAILURE);
+  }
+  if (what == SC_RATE && strcmp(value, "half") == 0) {
+    v = 0.5;
+    relative = 1;
+  } else if (what == SC_RATE && strcmp(value, "double") == 0) {
+    v = 2;
+    relative = 1;
+  } else
+    v = atof(value);
+  if (what == SC_RATE && links[A].rate == 0 && links[B].rate == 0) {
+    printf("%s:%d: rate changes need the link model (linkrate=)\n", file, line);
+    exit(EXIT_FAILURE);
+  }
+  addchange(at, line, what, dir, v, relative);
+}
+
+static void scenarioinit(void)
+{
+  const char *file = getoptionstr("scenario", NULL);
+  char buf[256], *token;
+  FILE *f;
+  double at, length;
+  int line = 0, dir;
+  struct event *evptr;
+
+  interval = getoption("interval", 500);
+  if (file == NULL)
+    return;
+  if (nhops > 0) {
+    printf("scenarios change the single-hop channel and cannot be used with topology=\n");
+    exit(EXIT_FAILURE);
+  }
+  f = fopen(file, "r");
+  if (f == NULL) {
+    printf("cannot read scenario %s.", file);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    line++;
+    token = strtok(buf, " \t\r\n");
+    if (token == NULL || token[0] == '#')
+      continue;
+    if (strncmp(token, "t=", 2) != 0) {
+      printf("%s:%d: a change must start with t=<time>\n", file, line);
+      exit(EXIT_FAILURE);
+    }
+    at = atof(token + 2);
+    while ((token = strtok(NULL, " \t\r\n")) != NULL && token[0] != '#') {
+      if (strcmp(token, "link") == 0)
+        dir = 2;
+      else if (strcmp(token, "link_ab") == 0)
+        dir = A;
+      else if (strcmp(token, "link_ba") == 0)
+        dir = B;
+      else {
+        parsechange(file, line, at, token);
+        continue;
+      }
+      token = strtok(NULL, " \t\r\n");
+      if (token != NULL && strcmp(token, "up") == 0)
+        addchange(at, line, SC_UP, dir, 0, 0);
+      else if (token != NULL && strcmp(token, "down") == 0) {
+        addchange(at, line, SC_DOWN, dir, 0, 0);
+        token = strtok(NULL, " \t\r\n");
+        if (token != NULL && (length = atof(token)) > 0)
+          addchange(at + length, line, SC_UP, dir, 0, 0);
+        else if (token != NULL)
+          parsechange(file, line, at, token);
+      } else {
+        printf("%s:%d: expected link up or link down <duration>\n", file, line);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+  fclose(f);
+  qsort(changes, nchanges, sizeof(struct change), changeorder);
+  nextchange = 0;
+  if (nchanges == 0)
+    return;
+
+  evptr = malloc(sizeof(struct event));
+  if (evptr == NULL) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = changes[0].at;
+  evptr->evtype = SCENARIO;
+  evptr->eventity = A;
+  evptr->pktptr = NULL;
+  insertevent(evptr);
+}
+
+/* make one change in direction AorB */
+static void applychange(struct change *c, int AorB)
+{
+  double *setting = NULL;
+
+  switch (c->what) {
+  case SC_LOSS:
+    losses[AorB].prob = c->value;
+    if (c->value < 1)   /* keep ge's bursts, at the new long run loss rate */
+      losses[AorB].p = losses[AorB].r * c->value / (1 - c->value);
+    return;
+  case SC_CORRUPT:
+    corruptprob = c->value;
+    return;
+  case SC_DOWN:
+  case SC_UP:
+    linkdown[AorB] = c->what == SC_DOWN;
+    return;
+  case SC_RATE:
+    setting = &links[AorB].rate;
+    break;
+  case SC_LINKDELAY:
+    setting = &links[AorB].delay;
+    break;
+  case SC_REORDER:
+    setting = &delays[AorB].reorder;
+    break;
+  case SC_DELAYMIN:
+    setting = &delays[AorB].min;
+    break;
+  case SC_DELAYMAX:
+    setting = &delays[AorB].max;
+    break;
+  case SC_DELAYMEAN:
+    setting = &delays[AorB].mean;
+    break;
+  }
+  if (c->what == SC_RATE && *setting == 0)
+    return;   /* this direction uses the original channel */
+  *setting = c->relative ? *setting * c->value : c->value;
+}
+
+/* a SCENARIO event: make the changes that are due and wait for the next */
+static void scenariostep(struct event *evptr)
+{
+  struct change *c;
+
+  while (nextchange < nchanges && changes[nextchange].at <= time) {
+    c = &changes[nextchange++];
+    if (TRACE>0)
+      printf("          SCENARIO: %s at %f\n", c->what == SC_DOWN ? "link down" :
+             c->what == SC_UP ? "link up" : changenames[c->what], time);
+    if (c->what == SC_DOWN && !linkdown[A] && !linkdown[B])
+      outages++;
+    if (c->dir != B)
+      applychange(c, A);
+    if (c->dir != A)
+      applychange(c, B);
+    if (c->what == SC_UP && !linkdown[A] && !linkdown[B])
+      lastup = time;
+  }
+  if (nextchange < nchanges) {
+    evptr->evtime = changes[nextchange].at;
+    insertevent(evptr);
+  } else
+    free(evptr);
+}
+
+/* whether every event left is a SCENARIO one, whose changes nothing */
+/* is left to notice                                                  */
+static int scenariosleft(void)
+{
+  int i;
+
+  for (i = 0; i < nevents; i++)
+    if (evheap[i]->evtype != SCENARIO)
+      return 0;
+  return 1;
+}
+
+static void scenarioreport(void)
+{
+  int i;
+
+  printf("outages:  %d, mean time from the link coming back to the next delivery:  %f (max %f)\n",
+         outages, recoveries > 0 ? recovery_total / recoveries : 0.0, recovery_max);
+  printf("goodput in each interval of %g time units (payload bytes per time unit):\n", interval);
+  for (i = 0; i < nintervals; i++)
+    printf("  %10.1f  %.3f\n", i * interval, intervalbytes[i] / interval);
+}
+
+/* processor time used so far, in seconds */
+static double cputime(void)
+{
+  struct rusage usage;
+
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* how evenly the flows were served, and what running them cost */
+static void flowreport(void)
+{
+  struct flowstats *f;
+  double goodput, min = 0, max = 0, cpu = cputime();
+  double share, sum = 0, sumsq = 0;
+  int i, idle = 0;
+
+  for (i = 0; i < nflows; i++) {
+    f = &flowstats[i];
+    goodput = time > 0 ? f->bytes / time : 0.0;
+    if (i == 0 || goodput < min)
+      min = goodput;
+    if (goodput > max)
+      max = goodput;
+    if (f->delivered == 0)
+      idle++;
+    share = (double)f->bytes / quanta[i];   /* relative to what DRR entitles the flow to */
+    sum += share;
+    sumsq += share * share;
+  }
+  printf("flows:  %d, per-flow goodput min %.3f, mean %.3f, max %.3f; %d flows delivered nothing\n",
+         nflows, min, time > 0 ? bytesdelivered / time / nflows : 0.0, max, idle);
+  /* Jain's index: 1 when every flow gets the same, 1/flows when one gets it all */
+  printf("Jain's fairness index of per-flow goodput%s:  %.4f\n",
+         getoptionstr("quanta", NULL) != NULL ? " (weighted by quanta)" : "",
+         sumsq > 0 ? sum * sum / (nflows * sumsq) : 1.0);
+  if (getoption("flowstats", 0) != 0)
+    for (i = 0; i < nflows; i++) {
+      f = &flowstats[i];
+      printf("  flow %d: %d messages offered, %d delivered (%ld bytes), %d packets, %d resent\n",
+             i, f->offered, f->delivered, f->bytes, f->packets, f->resent);
+    }
+  printf("events processed:  %ld, largest event list:  %d, CPU time:  %.3f s (%.0f events per second)\n",
+         evprocessed, evhighwater, cpu, cpu > 0 ? evprocessed / cpu : 0.0);
+}
+
+void init(void)                         /* initialize the simulator */
+{
+  float sum, avg;
+  int i;
+
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  corruptdirection = 2;   /* loss models may still lose packets in both directions */
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+  mtu = (int)getoption("mtu", 20);
+  if (mtu < 1 || mtu > MAXMTU) {
+    printf("mtu must be between 1 and %d bytes\n", MAXMTU);
+    exit(EXIT_FAILURE);
+  }
+  msgsize = (int)getoption("msgsize", 20);
+  if (msgsize < 1 || msgsize > MAXMSG) {
+    printf("msgsize must be between 1 and %d bytes\n", MAXMSG);
+    exit(EXIT_FAILURE);
+  }
+  msgdata = malloc(msgsize);
+  if (msgdata == 0) {
+    printf("memory allocation for message failed.");
+    exit(EXIT_FAILURE);
+  }
+  nflows = (int)getoption("flows", 1);
+  if (nflows < 1) {
+    printf("flows must be at least 1\n");
+    exit(EXIT_FAILURE);
+  }
+  headersize = HEADERSIZE + (nflows > 1 ? CONNIDSIZE : 0);
+  flowstats = calloc(nflows, sizeof(struct flowstats));
+  if (flowstats == NULL) {
+    printf("memory allocation for flow statistics failed.");
+    exit(EXIT_FAILURE);
+  }
+  quantainit();
+  topologyinit();
+  linkinit(A);
+  linkinit(B);
+  lossinit(A);
+  lossinit(B);
+  delayinit(A);
+  delayinit(B);
+
+
+  rngseed(&rngs[0], 9999);  /* init random number generator */
+  sum = 0.0;                /* test random number generator for students */
+  for (i=0; i<1000; i++)
+    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
+  avg = sum/1000.0;
+  if (avg < 0.25 || avg > 0.75) {
+    printf("It is likely that random number generation on your machine\n" ); 
+    printf("is different from what this emulator expects.  Please take\n");
+    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* initialise statistics */
+  window_full = 0;
+  total_ACKs_received = 0;
+  packets_resent = 0;
+  new_ACKs = 0;
+  packets_received = 0;
+  backlog_queued = 0;
+  backlog_highwater = 0;
+  backlog_delay = 0.0;
+  backlog_maxdelay = 0.0;
+  coalesced_msgs = 0;
+  coalesce_saved = 0;
+  coalesce_delay = 0.0;
+  acks_sent = 0;
+  acks_coalesced = 0;
+  acks_piggybacked = 0;
+  ackbytes_sent = 0;
+  ackbytes_saved = 0;
+  spurious_resends = 0;
+  naks_sent = 0;
+  nak_resends = 0;
+  recovered_nak = 0;
+  recovered_timeout = 0;
+  recovery_nak_time = 0.0;
+  recovery_timeout_time = 0.0;
+  timeouts = 0;
+  rtt_samples = 0;
+  rtt_sample_total = 0.0;
+  rto_last = 0.0;
+  cwnd_cuts = 0;
+  cwnd_area = 0.0;
+  cwnd_changed = 0.0;
+  cwnd_last = 0.0;
+  paced_packets = 0;
+  pace_delay = 0.0;
+  for (i = 0; i < RECVHIST; i++)
+    recv_held[i] = 0;
+  for (i = 0; i < LATBUCKETS; i++) {
+    msg_latency[i] = 0;
+    hol_wait[i] = 0;
+  }
+  msg_latency_total = msg_latency_max = 0.0;
+  hol_wait_total = hol_wait_max = 0.0;
+  for (i = 0; i < NBURSTBINS; i++)
+    bursts[i] = 0;
+  burstlen = 0;
+  maxburst = 0;
+  packets_lost = 0;  
+  packets_corrupt = 0;
+  packets_sent = 0;
+  packets_timeout = 0;
+  messages_delivered = 0;
+
+  ntolayer3 = 0;
+  nlost = 0;
+  ncorrupt = 0;
+  bytestolayer3 = 0;
+  payloadtolayer3 = 0;
+  byteslost = 0;
+  bytesdelivered = 0;
+
+  time=0.0;                    /* initialize time to 0.0 */
+  bidirectional = getoption("bidirectional", BIDIRECTIONAL) != 0;
+  nthreads = (int)getoption("threads", 0);
+  if (nthreads < 0) {
+    printf("threads must be at least 0\n");
+    exit(EXIT_FAILURE);
+  }
+  lporder = getoption("parallelorder", 0) != 0;
+  replayinit();
+  if (nthreads == 0 && !lporder)   /* the logical processes start their own */
+    generate_next_arrival();     /* initialize event list */
+  scenarioinit();
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(int AorB)
+/* A or B is trying to stop timer */
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n",time);
+  if (timerevents[AorB] != NULL) {
+    removeevent(timerevents[AorB]);
+    free(timerevents[AorB]);
+    timerevents[AorB] = NULL;
+    return;
+  }
+  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+}
+
+
+void starttimer(int AorB, double increment)
+/* A or B is trying to start timer */
+{
+
+  struct event *evptr;
+
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n",time);
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (timerevents[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+ 
+  /* create future event for when timer goes off */
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime =  time + increment;
+  evptr->evtype =  TIMER_INTERRUPT;
+   
+ 
+  evptr->eventity = AorB;
+  evptr->pktptr = NULL;
+  timerevents[AorB] = evptr;
+  insertevent(evptr);
+} 
+
+
+/************************** TOLAYER3 ***************/
+/* count the burst in progress, if any */
+static void endburst(void)
+{
+  int bin = 0;
+
+  if (burstlen == 0)
+    return;
+  while (bin < NBURSTBINS - 1 && burstlen > (1 << bin))
+    bin++;
+  bursts[bin]++;
+  if (burstlen > maxburst)
+    maxburst = burstlen;
+  burstlen = 0;
+}
+
+/* latest arrival time of the packets the original channel has scheduled */
+/* for A and for B, so a new one is not scheduled to arrive before them  */
+static LPLOCAL double lastarrival[2];
+
+void tolayer3(int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  struct pkt *mypktptr;
+  struct event *evptr;
+  double lastime, delay;
+  float x;
+
+  if (packet.length < 0 || packet.length > mtu) {
+    printf("Warning: packet with %d payload bytes does not fit the mtu of %d, not sent\n",
+           packet.length, mtu);
+    return;
+  }
+
+  if (AorB == A) {
+    if (burstlen > 0 && time != burstat)
+      endburst();
+    burstat = time;
+    burstlen++;
+  }
+
+  ntolayer3++;
+  if (packet.connid >= 0 && packet.connid < nflows)
+    flowstats[packet.connid].packets++;
+  bytestolayer3 += headersize + packet.length;
+  payloadtolayer3 += packet.length;
+
+  if (nhops == 0 && links[AorB].rate > 0 && !linkadmit(AorB, headersize + packet.length))
+    return;
+
+  /* simulate losses (on the hops with a topology): */
+  if (nhops == 0 && (linkdown[AorB] || lossdraw(AorB))) {
+    nlost++;
+    byteslost += headersize + packet.length;
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being lost\n");
+    if (links[AorB].rate > 0)
+      linkenqueue(AorB, NULL, headersize + packet.length, packet.connid);   /* still uses the link */
+    return;
+  }  
+
+  /* make a copy of the packet student just gave me since he/she may decide */
+  /* to do something with the packet after we return back to him/her */ 
+  mypktptr = malloc(sizeof(struct pkt));
+  if (mypktptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  mypktptr->seqnum = packet.seqnum;
+  mypktptr->acknum = packet.acknum;
+  mypktptr->checksum = packet.checksum;
+  mypktptr->length = packet.length;
+  mypktptr->flags = packet.flags;
+  mypktptr->connid = packet.connid;
+  mypktptr->payload = NULL;
+  if (packet.length > 0) {
+    mypktptr->payload = getbuf();
+    memcpy(mypktptr->payload, packet.payload, packet.length);
+  }
+  if (TRACE>2)  {
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d, length: %d ", mypktptr->seqnum,
+           mypktptr->acknum,  mypktptr->checksum, mypktptr->length);
+    printf("%.*s\n", mypktptr->length < 20 ? mypktptr->length : 20,
+           mypktptr->payload ? mypktptr->payload : "");
+  }
+
+  /* create future event for arrival of packet at the other side */
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
+  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
+  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  /* finally, compute the arrival time of packet at the other end.
+     medium can not reorder, so make sure packet arrives between 1 and 10
+     time units after the latest arrival time of packets
+     currently in the medium on their way to the destination */
+  if (nhops == 0 && links[AorB].rate == 0) {  /* the link sets it when the packet is sent */
+    lastime = time;
+    if (lastarrival[evptr->eventity] > lastime)
+      lastime = lastarrival[evptr->eventity];
+    delay = delays[AorB].ops->sample(&delays[AorB]);
+    if (delay < 0) {   /* the options are checked, so this is a bug in a model */
+      printf("delay %s drew a negative delay %f.", delays[AorB].ops->name, delay);
+      exit(EXIT_FAILURE);
+    }
+    if (delays[AorB].reorder > 0 && jimsrand() < delays[AorB].reorder) {
+      evptr->evtime = time + delay;
+      if (evptr->evtime < lastime)
+        delays[AorB].reordered++;
+    }
+    else
+      evptr->evtime = lastime + delay;
+    if (evptr->evtime > lastarrival[evptr->eventity])
+      lastarrival[evptr->eventity] = evptr->evtime;
+    delays[AorB].samples++;
+    delays[AorB].total += delay;
+  }
+ 
+
+
+  /* simulate corruption: */
+  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+    ncorrupt++;
+    if ( (x = jimsrand()) < .75 && mypktptr->length > 0)
+      mypktptr->payload[0]='Z';   /* corrupt payload */
+    else if (x < .75)
+      mypktptr->length = -1;      /* no payload to corrupt, hit the length field */
+    else if (x < .875)
+      mypktptr->seqnum = 999999;
+    else
+      mypktptr->acknum = 999999;
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being corrupted\n");
+  }  
+
+  if (TRACE>2)  
+    printf("          TOLAYER3: scheduling arrival on other side\n");
+  if (nhops > 0)
+    forward(AorB, evptr);
+  else if (links[AorB].rate > 0)
+    linkenqueue(AorB, evptr, headersize + packet.length, packet.connid);
+  else
+    insertevent(evptr);
+} 
+
+void tolayer5(int AorB, char *datasent, int length, int connid)
+{
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at ");
+    if (AorB == A) 
+      printf("A: ");
+    else
+      printf("B: ");
+    printf("%.*s (%d bytes)\n", length < 20 ? length : 20, datasent, length);
+  }
+  messages_delivered++;
+  bytesdelivered += length;
+  if (connid >= 0 && connid < nflows) {
+    flowstats[connid].delivered++;
+    flowstats[connid].bytes += length;
+  }
+  if (lastup >= 0) {
+    recoveries++;
+    recovery_total += time - lastup;
+    if (time - lastup > recovery_max)
+      recovery_max = time - lastup;
+    lastup = -1;
+  }
+  if (nchanges > 0 && interval > 0) {
+    while ((int)(time / interval) >= nintervals) {
+      intervalbytes = realloc(intervalbytes, (nintervals + 1) * sizeof(long));
+      if (intervalbytes == NULL) {
+        printf("memory allocation for goodput intervals failed.");
+        exit(EXIT_FAILURE);
+      }
+      intervalbytes[nintervals++] = 0;
+    }
+    intervalbytes[(int)(time / interval)] += length;
+  }
+}
+
+/* carry out the next event, taken off the event list */
+static void runevent(struct event *eventptr)
+{
+  struct msg  msg2give;
+  struct pkt  pkt2give;
+  int j;
+
+  removeevent(eventptr);        /* remove this event from event list */
+  if (eventptr->evseq >= evinserted)   /* what it makes comes after it */
+    evinserted = eventptr->evseq + 1;
+  evprocessed++;
+  if (recordf != NULL || replaylog != NULL)
+    logevent(eventptr);
+  if (eventptr->evtype == TIMER_INTERRUPT && eventptr == timerevents[eventptr->eventity])
+    timerevents[eventptr->eventity] = NULL;
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",eventptr->evtime);
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else if (eventptr->evtype==2)
+      printf(", fromlayer3 ");
+    else if (eventptr->evtype==3)
+      printf(", linkdone ");
+    else if (eventptr->evtype==4)
+      printf(", scenario ");
+    else
+      printf(", router ");
+    printf(" entity: %d\n",eventptr->eventity);
+  }
+  time = eventptr->evtime;        /* update time to next event time */
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (nsim < nsimmax) {
+      generate_next_arrival();   /* set up future arrival */
+      if (lpid >= 0 && eventptr->eventity != lpid) {
+        nsim++;                  /* another process's message, counted to keep in step */
+        free(eventptr);
+        return;
+      }
+      /* fill in msg to give with string of same letter */    
+      j = nsim % 26; 
+      memset(msgdata, 97 + j, msgsize);
+      msg2give.length = msgsize;
+      msg2give.connid = eventptr->evflow;
+      msg2give.data = msgdata;
+      flowstats[msg2give.connid].offered++;
+      if (TRACE>2) {
+        printf("          MAINLOOP: data given to student: ");
+        printf("%.*s (%d bytes)\n", msgsize < 20 ? msgsize : 20, msgdata, msgsize);
+      }
+      nsim++;
+      if (eventptr->eventity == A) 
+        A_output(msg2give);  
+      else
+        B_output(msg2give);  
+    }
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    pkt2give.seqnum = eventptr->pktptr->seqnum;
+    pkt2give.acknum = eventptr->pktptr->acknum;
+    pkt2give.checksum = eventptr->pktptr->checksum;
+    pkt2give.length = eventptr->pktptr->length;
+    pkt2give.flags = eventptr->pktptr->flags;
+    pkt2give.connid = eventptr->pktptr->connid;
+    pkt2give.payload = eventptr->pktptr->payload;
+	    if (eventptr->eventity ==A)      /* deliver packet by calling */
+      A_input(pkt2give);            /* appropriate entity */
+    else
+      B_input(pkt2give);
+	    putbuf(eventptr->pktptr->payload); /* recycle the payload buffer */
+	    free(eventptr->pktptr);          /* free the memory for packet */
+  }
+  else if (eventptr->evtype ==  LINK_DONE)
+    linkdone(eventptr->eventity);
+  else if (eventptr->evtype ==  SCENARIO) {
+    scenariostep(eventptr);
+    return;                     /* the event is reused for the next change */
+  }
+  else if (eventptr->evtype ==  ROUTER) {
+    forwarded++;
+    forward(eventptr->evnode, eventptr);
+    return;                     /* the event goes on to the next hop */
+  }
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    if (eventptr->eventity == A) 
+      A_timerinterrupt();
+    else
+      B_timerinterrupt();
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  free(eventptr);
+}
+
+/********************* PARALLEL ENGINE ***************/
+/* threads=N runs the model as logical processes, one for each node (A,  */
+/* B and the routers of topology=), at most N of them at once on threads */
+/* of their own.  Each process keeps its own event list, statistics and  */
+/* random number streams, and owns the links, loss and delay models it   */
+/* sends on.  The processes move on in windows as long as the lookahead, */
+/* the least time a packet takes to reach another node (YAWNS): nothing  */
+/* done in a window can happen at another node before the window ends,   */
+/* so each process runs its window alone and hands the packets it sent   */
+/* on at the barrier that ends it.  A and B both draw the whole arrival  */
+/* process from a stream of their own and keep only their own messages.  */
+/* The results are the same for any number of threads, but not the same  */
+/* as the default sequential engine's, which draws everything from one   */
+/* stream and runs events at the same time newest first.  Only with      */
+/* parallelorder=1, which runs the sequential engine with the processes' */
+/* streams and event order, does it give the results of threads= exactly */
+/* (all but the count of payload buffers, pooled per process here).      */
+
+/* optimistic=1 lets the processes run ahead instead (Time Warp): each   */
+/* runs its events as they come, saving its state every statesave=       */
+/* events.  An event that arrives for a time the process has already run */
+/* past sends it back to the last state saved before it; it cancels what */
+/* it sent since with antimessages and runs forward again, without       */
+/* sending anew what it had sent before the straggler.  Every gvtevents= */
+/* events the processes stop and agree on the global virtual time, the   */
+/* time of the earliest event left anywhere: nothing before it can be    */
+/* undone, so the states saved and the events kept for rolling back      */
+/* before it are freed.  No process runs more than optwindow= time units */
+/* past it, or A, which never waits for anything but its own arrivals,   */
+/* would run so far ahead that it is always being rolled back.  The      */
+/* processes run their events in the same order as under the             */
+/* conservative engine, and give the same results, but need no           */
+/* lookahead.                                                            */
+
+/* where an event comes in the order the processes run them */
+struct evkey {
+  double time;
+  long seq;
+  int source;
+};
+
+/* an event or antimessage on its way to another process */
+struct twmsg {
+  struct event *ev;         /* NULL for an antimessage */
+  long seq;                 /* antimessage: evseq and evsource of the event it cancels */
+  int source;
+};
+
+/* an event received, kept until it can no longer be rolled back */
+struct twinput {
+  struct event *ev;
+  int cancelled;            /* its antimessage has come */
+};
+
+/* an event sent, kept while it may have to be cancelled */
+struct twoutput {
+  struct evkey sentby;      /* the event that sent it */
+  long seq;
+  int node;
+};
+
+/* a saved state, after the event last */
+struct twstate {
+  struct evkey last;
+  char *data;
+  size_t len;
+};
+
+/* the statistics of a process, and how those of all processes combine: */
+/* add what each counted, take the largest, or keep A's                 */
+#define LPSUM(total, end, start) ((total) + ((end) - (start)))
+#define LPMAX(total, end, start) ((end) > (total) ? (end) : (total))
+#define LPKEEP(total, end, start) (total)
+#define LPSTATS(X) \
+  X(int, total_ACKs_received, LPSUM) X(int, packets_resent, LPSUM) \
+  X(int, new_ACKs, LPSUM) X(int, packets_received, LPSUM) X(int, window_full, LPSUM) \
+  X(int, backlog_queued, LPSUM) X(int, backlog_highwater, LPMAX) \
+  X(double, backlog_delay, LPSUM) X(double, backlog_maxdelay, LPMAX) \
+  X(int, coalesced_msgs, LPSUM) X(int, coalesce_saved, LPSUM) X(double, coalesce_delay, LPSUM) \
+  X(int, acks_sent, LPSUM) X(int, acks_coalesced, LPSUM) X(int, acks_piggybacked, LPSUM) \
+  X(long, ackbytes_sent, LPSUM) X(long, ackbytes_saved, LPSUM) \
+  X(int, spurious_resends, LPSUM) X(int, naks_sent, LPSUM) X(int, nak_resends, LPSUM) \
+  X(int, recovered_nak, LPSUM) X(int, recovered_timeout, LPSUM) \
+  X(double, recovery_nak_time, LPSUM) X(double, recovery_timeout_time, LPSUM) \
+  X(int, timeouts, LPSUM) X(int, rtt_samples, LPSUM) X(double, rtt_sample_total, LPSUM) \
+  X(double, rto_last, LPKEEP) X(int, cwnd_cuts, LPSUM) X(double, cwnd_area, LPSUM) \
+  X(double, cwnd_changed, LPKEEP) X(double, cwnd_last, LPKEEP) \
+  X(int, paced_packets, LPSUM) X(double, pace_delay, LPSUM) X(int, recv_held, LPSUM) \
+  X(int, msg_latency, LPSUM) X(double, msg_latency_total, LPSUM) X(double, msg_latency_max, LPMAX) \
+  X(int, hol_wait, LPSUM) X(double, hol_wait_total, LPSUM) X(double, hol_wait_max, LPMAX) \
+  X(int, packets_lost, LPSUM) X(int, packets_corrupt, LPSUM) X(int, packets_sent, LPSUM) \
+  X(int, packets_timeout, LPSUM) X(int, messages_delivered, LPSUM) \
+  X(int, nsim, LPKEEP) X(double, time, LPMAX) \
+  X(int, ntolayer3, LPSUM) X(int, nlost, LPSUM) X(int, ncorrupt, LPSUM) \
+  X(long, bytestolayer3, LPSUM) X(long, payloadtolayer3, LPSUM) \
+  X(long, byteslost, LPSUM) X(long, bytesdelivered, LPSUM) \
+  X(int, bursts, LPSUM) X(int, burstlen, LPKEEP) X(double, burstat, LPKEEP) \
+  X(int, maxburst, LPMAX) X(int, nbufs, LPSUM) X(long, forwarded, LPSUM) \
+  X(long, evprocessed, LPSUM) X(int, evhighwater, LPMAX)
+
+#define LPFIELD(type, var, how) type var[sizeof(var) / sizeof(type)];
+#define LPSAVE(type, var, how) memcpy(s->var, &var, sizeof(var));
+#define LPLOAD(type, var, how) memcpy(&var, s->var, sizeof(var));
+#define LPMERGE(type, var, how) \
+  for (i = 0; i < (int)(sizeof(var) / sizeof(type)); i++) \
+    ((type *)&var)[i] = how(((type *)&var)[i], s->var[i], startstats.var[i]);
+
+struct lpstats {
+  LPSTATS(LPFIELD)
+};
+
+struct lpsent {
+  int node;                 /* kept here, as the event itself may be gone by the time */
+  struct event *ev;         /* the other processes look at it                         */
+};
+
+struct lp {
+  pthread_t thread;
+  struct lpsent *sent[2];   /* events for other processes, by the parity of the window */
+  int nsent[2], maxsent[2];
+  double sentfirst;         /* earliest of the events sent in this window */
+  double next[2];           /* earliest event here or sent on, at the end of a window */
+  struct event **initial;   /* the events init() put on the list for this node */
+  int ninitial;
+  struct lpstats stats;     /* at the end */
+  struct flowstats *flowstats;
+  char **returned;          /* payload buffers of this process the others are done with */
+  int nreturned, maxreturned;   /* held under lock */
+
+  /* the optimistic engine */
+  pthread_mutex_t lock;     /* held to use inbox */
+  struct twmsg *inbox, *spare;  /* sent here, oldest first; spare is swapped in to take them */
+  int ninbox, maxinbox, maxspare;
+  struct twinput *in;       /* received, in the order they came */
+  int nin, maxin;
+  struct twoutput *out;     /* sent, in the order they were sent */
+  int nout, maxout;
+  struct twstate *states;   /* saved, oldest first */
+  int nstates, maxstates;
+  struct evkey lvt;         /* the last event run */
+  int sincesave;            /* events run since the state was saved */
+  long executed, rollbacks, antimessages, saves;
+  double savedbytes;
+};
+
+static struct lp *lps;            /* one for each node */
+static int nlps;
+static double lookahead;          /* length of a window */
+static long windows;              /* or rounds of the optimistic engine */
+static int optimistic;            /* optimistic=, for Time Warp */
+static int stateevery;            /* statesave=, events between states saved */
+static int gvtevents;             /* gvtevents=, events between GVT rounds */
+static double optwindow;          /* optwindow=, how far past GVT a process may run */
+static double walltime;           /* seconds the processes ran for */
+static struct lpstats startstats; /* as init() left them */
+static pthread_barrier_t windowend;
+static sem_t running;             /* the processes that may run at once */
+static LPLOCAL double horizon;    /* end of the current window */
+static LPLOCAL int parity;        /* of the current window */
+static LPLOCAL int coasting;      /* running forward again to a straggler */
+static void twsend(struct event *);
+
+static void lpsave(struct lpstats *s)
+{
+  LPSTATS(LPSAVE)
+}
+
+static void lpload(struct lpstats *s)
+{
+  LPSTATS(LPLOAD)
+}
+
+/* the node an event happens at */
+static int lpnode(struct event *ev)
+{
+  return ev->evtype == LINK_DONE || ev->evtype == ROUTER ? ev->evnode : ev->eventity;
+}
+
+/* room for one more element in an array of *max */
+static void *lpgrow(void *array, int n, int *max, size_t size)
+{
+  if (n < *max)
+    return array;
+  *max = *max > 0 ? 2 * *max : 64;
+  array = realloc(array, *max * size);
+  if (array == NULL) {
+    printf("memory allocation for logical process failed.");
+    exit(EXIT_FAILURE);
+  }
+  return array;
+}
+
+/* hand an event to the process of its node at the end of the window */
+static void lpsend(struct event *ev)
+{
+  struct lp *p = &lps[lpid];
+
+  if (optimistic) {
+    twsend(ev);
+    return;
+  }
+  if (ev->evtime < horizon) {
+    printf("INTERNAL PANIC: event at %f sent inside the window ending at %f\n", ev->evtime, horizon);
+    exit(EXIT_FAILURE);
+  }
+  p->sent[parity] = lpgrow(p->sent[parity], p->nsent[parity], &p->maxsent[parity],
+                           sizeof(struct lpsent));
+  p->sent[parity][p->nsent[parity]].node = lpnode(ev);
+  p->sent[parity][p->nsent[parity]++].ev = ev;
+  if (ev->evtime < p->sentfirst)
+    p->sentfirst = ev->evtime;
+}
+
+/* make ev, which the process from sent here, carry a payload buffer of */
+/* this process, and give from's buffer back to it; otherwise every     */
+/* buffer A sends would end up in B's list, and A would keep allocating */
+static struct event *lpadopt(struct event *ev, int from)
+{
+  struct lp *p = &lps[from];
+  char *buf;
+
+  if (ev->pktptr == NULL || ev->pktptr->payload == NULL)
+    return ev;
+  buf = getbuf();
+  if (ev->pktptr->length > 0)
+    memcpy(buf, ev->pktptr->payload, ev->pktptr->length);
+  pthread_mutex_lock(&p->lock);
+  p->returned = lpgrow(p->returned, p->nreturned, &p->maxreturned, sizeof(char *));
+  p->returned[p->nreturned++] = ev->pktptr->payload;
+  pthread_mutex_unlock(&p->lock);
+  ev->pktptr->payload = buf;
+  return ev;
+}
+
+/* put the buffers the other processes gave back on the free list */
+static void lpreclaim(struct lp *p)
+{
+  pthread_mutex_lock(&p->lock);
+  while (p->nreturned > 0)
+    putbuf(p->returned[--p->nreturned]);
+  pthread_mutex_unlock(&p->lock);
+}
+
+/* the least time a packet can take to reach the next node */
+static double leastdelay(void)
+{
+  double least = HUGE_VAL, d;
+  int i;
+
+  for (i = 0; i < (nhops > 0 ? nhops : 2); i++) {
+    if (nhops > 0)
+      d = links[2 + i].delay + 8.0 * headersize / links[2 + i].rate;
+    else if (links[i].rate > 0)
+      d = links[i].delay + 8.0 * headersize / links[i].rate;
+    else
+      d = delays[i].ops->least(&delays[i]);
+    if (d < least)
+      least = d;
+  }
+  return least;
+}
+
+/* set the thread up for its process: the statistics as init() left */
+/* them, its own streams and buffers, and the events of its node     */
+static void lpstart(struct lp *p)
+{
+  int i;
+
+  lpid = p - lps;
+  lpload(&startstats);
+  rngseed(&rngs[0], 9999 + 1 + lpid);
+  rngseed(&rngs[1], 9999);        /* the same arrivals at A and B */
+  flowstats = calloc(nflows, sizeof(struct flowstats));
+  msgdata = malloc(msgsize);
+  if (flowstats == NULL || msgdata == NULL) {
+    printf("memory allocation for logical process failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < p->ninitial; i++) {
+    if (p->initial[i]->evtype == TIMER_INTERRUPT)
+      timerevents[p->initial[i]->eventity] = p->initial[i];
+    insertevent(p->initial[i]);
+  }
+  if (lpid == A || (lpid == B && bidirectional))
+    generate_next_arrival();
+}
+
+static void *lprun(void *arg)
+{
+  struct lp *p = arg;
+  double start;
+  int w, i, j;
+
+  lpstart(p);
+  p->next[1] = nevents > 0 ? evheap[0]->evtime : HUGE_VAL;
+  pthread_barrier_wait(&windowend);
+
+  for (w = 0;; w++) {
+    parity = w & 1;
+    start = HUGE_VAL;
+    for (i = 0; i < nlps; i++)
+      if (lps[i].next[!parity] < start)
+        start = lps[i].next[!parity];
+    if (start == HUGE_VAL)
+      break;
+    horizon = start + lookahead;
+    sem_wait(&running);
+    lpreclaim(p);
+    /* take the events sent here in the last window, always in the same order */
+    for (i = 0; i < nlps; i++)
+      for (j = 0; j < lps[i].nsent[!parity]; j++)
+        if (lps[i].sent[!parity][j].node == lpid)
+          evpush(lpadopt(lps[i].sent[!parity][j].ev, i));
+    p->nsent[parity] = 0;
+    p->sentfirst = HUGE_VAL;
+    while (nevents > 0 && evheap[0]->evtime < horizon)
+      runevent(evheap[0]);
+    p->next[parity] = p->sentfirst;
+    if (nevents > 0 && evheap[0]->evtime < p->sentfirst)
+      p->next[parity] = evheap[0]->evtime;
+    sem_post(&running);
+    pthread_barrier_wait(&windowend);
+  }
+
+  if (lpid == A)
+    windows = w;
+  lpsave(&p->stats);
+  p->flowstats = flowstats;
+  return NULL;
+}
+
+/****************** STATE SAVING *********************/
+/* the optimistic engine saves the state of a process as bytes: its     */
+/* statistics, random number streams and events, the links, loss and    */
+/* delay models it sends on, and the state of its SR entity.  A         */
+/* checkpoint saves the whole simulator the same way                    */
+static LPLOCAL char *statedata;     /* the state being saved */
+static LPLOCAL size_t statelen, statecap;
+static LPLOCAL const char *stateat; /* where the state being loaded is read */
+static LPLOCAL const char *stateend;
+
+void statesave(const void *p, size_t n)
+{
+  if (statelen + n > statecap) {
+    statecap = 2 * (statelen + n);
+    statedata = realloc(statedata, statecap);
+    if (statedata == NULL) {
+      printf("memory allocation for saved state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(statedata + statelen, p, n);
+  statelen += n;
+}
+
+void stateload(void *p, size_t n)
+{
+  if (n > (size_t)(stateend - stateat)) {
+    printf("saved state ended early.");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(p, stateat, n);
+  stateat += n;
+}
+
+/* an event with no packet is not freed by freeevent() */
+static void evfree(struct event *ev)
+{
+  if (ev->pktptr != NULL)
+    freeevent(ev);
+  else
+    free(ev);
+}
+
+static void evsave(struct event *ev)
+{
+  statesave(ev, sizeof(*ev));
+  if (ev->pktptr != NULL) {
+    statesave(ev->pktptr, sizeof(struct pkt));
+    if (ev->pktptr->payload != NULL && ev->pktptr->length > 0)
+      statesave(ev->pktptr->payload, ev->pktptr->length);
+  }
+}
+
+static struct event *evload(void)
+{
+  struct event *ev = malloc(sizeof(struct event));
+  struct pkt *pkt = malloc(sizeof(struct pkt));
+
+  if (ev == NULL || pkt == NULL) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  stateload(ev, sizeof(*ev));
+  if (ev->pktptr == NULL) {
+    free(pkt);
+    return ev;
+  }
+  stateload(pkt, sizeof(*pkt));
+  if (pkt->payload != NULL) {
+    pkt->payload = getbuf();
+    if (pkt->length > 0)
+      stateload(pkt->payload, pkt->length);
+  }
+  ev->pktptr = pkt;
+  return ev;
+}
+
+/* a copy of ev and its packet */
+static struct event *evclone(struct event *ev)
+{
+  struct event *copy = malloc(sizeof(struct event));
+  struct pkt *pkt = ev->pktptr != NULL ? malloc(sizeof(struct pkt)) : NULL;
+
+  if (copy == NULL || (ev->pktptr != NULL && pkt == NULL)) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  *copy = *ev;
+  if (pkt != NULL) {
+    *pkt = *ev->pktptr;
+    if (pkt->payload != NULL) {
+      pkt->payload = getbuf();
+      if (pkt->length > 0)
+        memcpy(pkt->payload, ev->pktptr->payload, pkt->length);
+    }
+    copy->pktptr = pkt;
+  }
+  return copy;
+}
+
+static void ringsave(struct pktring *q)
+{
+  struct linkentry *e;
+  int i;
+
+  statesave(&q->count, sizeof(int));
+  for (i = 0; i < q->count; i++) {
+    e = &q->entries[(q->head + i) % q->cap];
+    statesave(e, sizeof(*e));
+    if (e->ev != NULL)
+      evsave(e->ev);
+  }
+}
+
+static void ringload(struct pktring *q)
+{
+  struct linkentry e;
+  int i, n;
+
+  while (q->count > 0) {
+    ringpop(q, &e);
+    freeevent(e.ev);
+  }
+  q->head = 0;
+  stateload(&n, sizeof(int));
+  for (i = 0; i < n; i++) {
+    stateload(&e, sizeof(e));
+    if (e.ev != NULL)
+      e.ev = evload();
+    ringpush(q, &e);
+  }
+}
+
+static void linksave(struct link *l)
+{
+  int i;
+
+  statesave(l, sizeof(*l));
+  if (l->sched == QUEUE_DRR) {
+    for (i = 0; i < nflows; i++) {
+      statesave(&l->flows[i].deficit, sizeof(int));
+      statesave(&l->flows[i].fresh, sizeof(int));
+      ringsave(&l->flows[i].ring);
+    }
+    statesave(l->active, nflows * sizeof(int));
+  } else
+    ringsave(&l->fifo);
+}
+
+/* the settings of a link or model are not loaded, so that a run resumed */
+/* from a checkpoint may change them; only what it holds and counted is  */
+static void linkload(struct link *l)
+{
+  struct link live = *l;
+  int i;
+
+  stateload(l, sizeof(*l));
+  l->rate = live.rate;
+  l->delay = live.delay;
+  l->limit = live.limit;
+  l->bytes = live.bytes;
+  l->aqm = live.aqm;
+  l->minth = live.minth;
+  l->maxth = live.maxth;
+  l->maxp = live.maxp;
+  l->weight = live.weight;
+  l->target = live.target;
+  l->interval = live.interval;
+  l->fifo = live.fifo;
+  l->flows = live.flows;
+  l->active = live.active;
+  if (l->sched == QUEUE_DRR) {
+    for (i = 0; i < nflows; i++) {
+      stateload(&l->flows[i].deficit, sizeof(int));
+      stateload(&l->flows[i].fresh, sizeof(int));
+      ringload(&l->flows[i].ring);
+    }
+    stateload(l->active, nflows * sizeof(int));
+  } else
+    ringload(&l->fifo);
+}
+
+static void lossload(struct lossmodel *m)
+{
+  struct lossmodel saved;
+
+  stateload(&saved, sizeof(saved));
+  m->inbad = saved.inbad;
+  m->tracepos = m->tracelen > 0 ? saved.tracepos % m->tracelen : 0;
+  m->offered = saved.offered;
+  m->lost = saved.lost;
+  m->bursts = saved.bursts;
+  m->run = saved.run;
+  m->maxrun = saved.maxrun;
+}
+
+static void delayload(struct delaymodel *m)
+{
+  struct delaymodel saved;
+
+  stateload(&saved, sizeof(saved));
+  m->samples = saved.samples;
+  m->total = saved.total;
+  m->reordered = saved.reordered;
+}
+
+/* the state of the thread's process; the events it was sent are kept */
+/* apart, so only those it made itself are saved                      */
+static void lpstatesave(void)
+{
+  struct lpstats s;
+  int i, n, timer;
+
+  lpsave(&s);
+  statesave(&s, sizeof(s));
+  statesave(rngs, sizeof(rngs));
+  statesave(&evinserted, sizeof(evinserted));
+  statesave(lastarrival, sizeof(lastarrival));
+  statesave(flowstats, nflows * sizeof(struct flowstats));
+  for (i = 0, n = 0; i < nevents; i++)
+    n += evheap[i]->evsource == lpid;
+  statesave(&n, sizeof(n));
+  for (i = 0; i < nevents; i++)
+    if (evheap[i]->evsource == lpid) {
+      timer = lpid <= B && evheap[i] == timerevents[lpid];
+      statesave(&timer, sizeof(timer));
+      evsave(evheap[i]);
+    }
+  if (nhops == 0 && lpid <= B && links[lpid].rate > 0)
+    linksave(&links[lpid]);
+  for (i = 0; i < nhops; i++)
+    if (hops[i].from == lpid)
+      linksave(&links[2 + i]);
+  if (nhops == 0) {
+    statesave(&losses[lpid], sizeof(struct lossmodel));
+    statesave(&delays[lpid], sizeof(struct delaymodel));
+  }
+  for (i = 0; i < nhops; i++)
+    if (hops[i].from == lpid)
+      statesave(&hops[i].loss, sizeof(struct lossmodel));
+  if (lpid == A)
+    A_save();
+  else if (lpid == B)
+    B_save();
+}
+
+static void lpstateload(void)
+{
+  struct lpstats s;
+  struct event *ev;
+  int i, n, timer;
+
+  stateload(&s, sizeof(s));
+  lpload(&s);
+  stateload(rngs, sizeof(rngs));
+  stateload(&evinserted, sizeof(evinserted));
+  stateload(lastarrival, sizeof(lastarrival));
+  stateload(flowstats, nflows * sizeof(struct flowstats));
+  for (i = 0; i < nevents; i++)
+    evfree(evheap[i]);
+  nevents = 0;
+  if (lpid <= B)
+    timerevents[lpid] = NULL;
+  stateload(&n, sizeof(n));
+  for (i = 0; i < n; i++) {
+    stateload(&timer, sizeof(timer));
+    ev = evload();
+    if (timer)
+      timerevents[lpid] = ev;
+    evpush(ev);
+  }
+  if (nhops == 0 && lpid <= B && links[lpid].rate > 0)
+    linkload(&links[lpid]);
+  for (i = 0; i < nhops; i++)
+    if (hops[i].from == lpid)
+      linkload(&links[2 + i]);
+  if (nhops == 0) {
+    lossload(&losses[lpid]);
+    delayload(&delays[lpid]);
+  }
+  for (i = 0; i < nhops; i++)
+    if (hops[i].from == lpid)
+      lossload(&hops[i].loss);
+  if (lpid == A)
+    A_restore();
+  else if (lpid == B)
+    B_restore();
+}
+
+/******************** CHECKPOINTS ***********************/
+/* checkpoint=T writes the whole state of the sequential engine to the    */
+/* file snapshot= when the simulation reaches time T, and again every     */
+/* checkpointevery= time units after, if set.  resume= starts a run from  */
+/* such a snapshot.  Its own prompts and options give the settings (the   */
+/* number of messages, loss, link and protocol parameters), so several    */
+/* what-if continuations can be run from one warm state; only the options */
+/* the buffers are laid out by must match.  The snapshot is the state    */
+/* saving of the optimistic engine, taken of the whole simulator          */
+#define SNAPSHOTMAGIC "srsnap2"
+
+static double checkpointat = -1;  /* checkpoint=, time of the next snapshot, -1 for none */
+static double checkpointevery;    /* checkpointevery=, 0 for one snapshot */
+static int checkpointstop;        /* checkpointstop=, end the run once it is written */
+static const char *checkpointfile;  /* snapshot= */
+static int checkpoints;           /* snapshots written */
+static double checkpointlast;     /* time of the last */
+static size_t checkpointbytes;    /* and its size */
+static const char *resumefrom;    /* resume= */
+static double resumedat;          /* time of the snapshot resumed from */
+
+/* the settings the buffers are laid out by, as the options give them, */
+/* and the links that exist                                             */
+static char *snapshotshape(void)
+{
+  char *shape = malloc(200 + 2 + nhops);
+  int i, n, window, space;
+
+  if (shape == NULL) {
+    printf("memory allocation for snapshot failed.");
+    exit(EXIT_FAILURE);
+  }
+  window_layout(&window, &space);
+  n = sprintf(shape, "flows=%d mtu=%d msgsize=%d bidirectional=%d window=%d seqspace=%d backlog=%d "
+              "latency=%d links=", (int)getoption("flows", 1), (int)getoption("mtu", 20),
+              (int)getoption("msgsize", 20), getoption("bidirectional", BIDIRECTIONAL) != 0,
+              window, space, (int)getoption("backlog", 0), getoption("latency", 0) != 0);
+  for (i = 0; i < 2 + nhops; i++)
+    shape[n++] = links[i].rate == 0 ? '-' : links[i].sched == QUEUE_DRR ? 'd' : 'f';
+  shape[n] = '\0';
+  return shape;
+}
+
+/* whether state saved under shape saved can be read into buffers laid */
+/* out as now: the same, except that a link may have been added         */
+static int shapefits(const char *saved, const char *now)
+{
+  size_t n = strstr(saved, "links=") + strlen("links=") - saved;
+
+  if (strlen(saved) != strlen(now) || strncmp(saved, now, n) != 0)
+    return 0;
+  for (; saved[n] != '\0'; n++)
+    if (saved[n] != now[n] && saved[n] != '-')
+      return 0;
+  return 1;
+}
+
+static void snapshotsave(void)
+{
+  struct lpstats s;
+  int i, timer, saved;
+
+  lpsave(&s);
+  statesave(&s, sizeof(s));
+  statesave(rngs, sizeof(rngs));
+  statesave(&evinserted, sizeof(evinserted));
+  statesave(lastarrival, sizeof(lastarrival));
+  statesave(flowstats, nflows * sizeof(struct flowstats));
+  statesave(&nevents, sizeof(nevents));
+  for (i = 0; i < nevents; i++) {
+    timer = evheap[i] == timerevents[A] ? A : evheap[i] == timerevents[B] ? B : -1;
+    statesave(&timer, sizeof(timer));
+    evsave(evheap[i]);
+  }
+  for (i = 0; i < 2 + nhops; i++) {
+    saved = links[i].rate > 0;
+    statesave(&saved, sizeof(saved));
+    if (saved)
+      linksave(&links[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    statesave(&losses[i], sizeof(struct lossmodel));
+    statesave(&delays[i], sizeof(struct delaymodel));
+  }
+  for (i = 0; i < nhops; i++)
+    statesave(&hops[i].loss, sizeof(struct lossmodel));
+  A_save();
+  B_save();
+}
+
+static void snapshotload(void)
+{
+  struct lpstats s;
+  struct event *ev;
+  int i, n, timer, saved, bufs = nbufs;
+
+  stateload(&s, sizeof(s));
+  lpload(&s);
+  nbufs = bufs;             /* the buffers this run allocated */
+  stateload(rngs, sizeof(rngs));
+  stateload(&evinserted, sizeof(evinserted));
+  stateload(lastarrival, sizeof(lastarrival));
+  stateload(flowstats, nflows * sizeof(struct flowstats));
+  for (i = 0; i < nevents; i++)
+    evfree(evheap[i]);
+  nevents = 0;
+  timerevents[A] = timerevents[B] = NULL;
+  stateload(&n, sizeof(n));
+  for (i = 0; i < n; i++) {
+    stateload(&timer, sizeof(timer));
+    ev = evload();
+    if (timer >= 0)
+      timerevents[timer] = ev;
+    evpush(ev);
+  }
+  for (i = 0; i < 2 + nhops; i++) {
+    stateload(&saved, sizeof(saved));
+    if (saved)              /* a link the snapshot did not have starts empty */
+      linkload(&links[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    lossload(&losses[i]);
+    delayload(&delays[i]);
+  }
+  for (i = 0; i < nhops; i++)
+    lossload(&hops[i].loss);
+  A_restore();
+  B_restore();
+}
+
+/* write the state as it is before the next event; a file of the same  */
+/* name is only replaced once the new one has been written whole        */
+static void checkpoint(void)
+{
+  char *shape = snapshotshape(), *tmp = malloc(strlen(checkpointfile) + 5);
+  size_t n = strlen(shape);
+  FILE *f;
+
+  if (tmp == NULL) {
+    printf("memory allocation for snapshot failed.");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(tmp, "%s.tmp", checkpointfile);
+  statelen = 0;
+  snapshotsave();
+  f = fopen(tmp, "wb");
+  if (f == NULL || fwrite(SNAPSHOTMAGIC, sizeof(SNAPSHOTMAGIC), 1, f) != 1 ||
+      fwrite(&n, sizeof(n), 1, f) != 1 || fwrite(shape, 1, n, f) != n ||
+      fwrite(statedata, 1, statelen, f) != statelen || fclose(f) != 0 ||
+      rename(tmp, checkpointfile) != 0) {
+    printf("cannot write snapshot %s.", checkpointfile);
+    exit(EXIT_FAILURE);
+  }
+  if (TRACE>0)
+    printf("          CHECKPOINT: state at time %f written to %s\n", time, checkpointfile);
+  checkpoints++;
+  checkpointlast = time;
+  checkpointbytes = sizeof(SNAPSHOTMAGIC) + sizeof(n) + n + statelen;
+  if (checkpointevery > 0)
+    while (checkpointat <= evheap[0]->evtime)
+      checkpointat += checkpointevery;
+  else
+    checkpointat = -1;
+  free(shape);
+  free(tmp);
+}
+
+static void resume(void)
+{
+  char magic[sizeof(SNAPSHOTMAGIC)], *shape = snapshotshape(), *saved = NULL, *data = NULL;
+  size_t n = 0;
+  long len = -1;
+  FILE *f = fopen(resumefrom, "rb");
+
+  if (f == NULL || fread(magic, sizeof(magic), 1, f) != 1 ||
+      memcmp(magic, SNAPSHOTMAGIC, sizeof(magic)) != 0 || fread(&n, sizeof(n), 1, f) != 1 ||
+      (saved = malloc(n + 1)) == NULL || fread(saved, 1, n, f) != n ||
+      fseek(f, 0, SEEK_END) != 0 || (len = ftell(f) - (long)(sizeof(magic) + sizeof(n) + n)) < 0 ||
+      fseek(f, -len, SEEK_END) != 0 || (data = malloc(len + 1)) == NULL ||
+      fread(data, 1, len, f) != (size_t)len) {
+    printf("cannot read snapshot %s.", resumefrom);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  saved[n] = '\0';
+  if (!shapefits(saved, shape)) {
+    printf("%s was taken with\n  %s\nbut this run has\n  %s\n", resumefrom, saved, shape);
+    exit(EXIT_FAILURE);
+  }
+  stateat = data;
+  stateend = data + len;
+  snapshotload();
+  if (stateat != stateend) {
+    printf("snapshot %s does not match this simulator.", resumefrom);
+    exit(EXIT_FAILURE);
+  }
+  resumedat = time;
+  if (TRACE>0)
+    printf("          RESUME: state at time %f read from %s\n", time, resumefrom);
+  free(shape);
+  free(saved);
+  free(data);
+}
+
+/* read the checkpoint options, and resume from a snapshot if asked; A */
+/* and B have been set up so their state can be read back into them   */
+static void checkpointinit(void)
+{
+  checkpointat = getoption("checkpoint", -1);
+  checkpointevery = getoption("checkpointevery", 0);
+  checkpointstop = getoption("checkpointstop", 0) != 0;
+  resumefrom = getoptionstr("resume", NULL);
+  if (checkpointat < 0 && resumefrom == NULL)
+    return;
+  if (nthreads > 0 || nchanges > 0) {
+    printf("checkpoints are taken of the sequential engine and cannot be used with threads or scenarios\n");
+    exit(EXIT_FAILURE);
+  }
+  if (checkpointevery < 0) {
+    printf("checkpointevery must be at least 0\n");
+    exit(EXIT_FAILURE);
+  }
+  if (checkpointat >= 0)
+    checkpointfile = getoptionstr("snapshot", "sr.snapshot");
+  if (resumefrom != NULL)
+    resume();
+}
+
+static void checkpointreport(void)
+{
+  if (resumefrom != NULL)
+    printf("resumed from %s at time %f\n", resumefrom, resumedat);
+  if (checkpointfile != NULL)
+    printf("checkpoints:  %d written to %s, the last at time %f (%lu bytes)\n",
+           checkpoints, checkpointfile, checkpointlast, (unsigned long)checkpointbytes);
+}
+
+/******************** WHAT-IF BRANCHES ***********************/
+/* branches= names a file of settings, one line of name=value options   */
+/* for each branch, e.g.                                                 */
+/*     lossprob=0.2                                                      */
+/*     rto=adaptive cc=reno                                              */
+/* When the simulation reaches time branchat= the emulator forks a       */
+/* process for each line.  The process puts the line's options before    */
+/* those of the command line, sets the channel and the entities up again */
+/* under them and carries the state over, as a run resumed from a        */
+/* checkpoint does.  It then runs to the end and sends its results back  */
+/* through a pipe.  The pages of the warm state stay shared until one    */
+/* of the processes writes to them.  The emulator goes on as the branch  */
+/* with the settings as given, and its report ends with a table of all   */
+/* of them                                                               */
+struct branch {
+  char *line;               /* the settings, as written */
+  char **options;           /* the line's options, then the command line's */
+  int noptions;
+  pid_t pid;
+};
+
+/* what a branch sends back */
+struct branchresult {
+  int branch;
+  double time;
+  int delivered;
+  long bytes;
+  int resent;
+  int timeouts;
+  int rtt_samples;
+  double rtt_total;
+};
+
+static struct branch *branches;
+static int nbranches;
+static double branchat = -1;      /* branchat=, time to fork the branches, -1 for none */
+static double branchedat;         /* the time they were forked */
+static int thisbranch;            /* 0 for the emulator itself */
+static int branchfd = -1;         /* the pipe the results come back on */
+
+static void whatifinit(void)
+{
+  const char *file = getoptionstr("branches", NULL);
+  char buf[256], *line, *copy, *token;
+  FILE *f;
+  int n = 0, i;
+  struct branch *b;
+
+  if (file == NULL)
+    return;
+  if (nthreads > 0 || nchanges > 0) {
+    printf("branches fork the sequential engine and cannot be used with threads or scenarios\n");
+    exit(EXIT_FAILURE);
+  }
+  f = fopen(file, "r");
+  if (f == NULL) {
+    printf("cannot read branches %s.", file);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(buf, sizeof(buf), f) != NULL) {
+    n++;
+    buf[strcspn(buf, "#\r\n")] = '\0';
+    line = buf + strspn(buf, " \t");
+    for (i = strlen(line); i > 0 && (line[i - 1] == ' ' || line[i - 1] == '\t'); i--)
+      line[i - 1] = '\0';
+    if (*line == '\0')
+      continue;
+    branches = realloc(branches, (nbranches + 1) * sizeof(struct branch));
+    b = &branches[nbranches];
+    copy = malloc(strlen(line) + 1);
+    b->line = malloc(strlen(line) + 1);
+    b->options = malloc((strlen(line) / 2 + 1 + noptions) * sizeof(char *));
+    if (branches == NULL || copy == NULL || b->line == NULL || b->options == NULL) {
+      printf("memory allocation for branches failed.");
+      exit(EXIT_FAILURE);
+    }
+    strcpy(b->line, line);
+    b->noptions = 0;
+    for (token = strtok(strcpy(copy, line), " \t"); token != NULL; token = strtok(NULL, " \t")) {
+      if (strchr(token, '=') == NULL) {
+        printf("%s:%d: expected name=value, found %s\n", file, n, token);
+        exit(EXIT_FAILURE);
+      }
+      b->options[b->noptions++] = token;
+    }
+    for (i = 0; i < noptions; i++)
+      b->options[b->noptions++] = options[i];
+    nbranches++;
+  }
+  fclose(f);
+  if (nbranches == 0) {
+    printf("%s has no branches\n", file);
+    exit(EXIT_FAILURE);
+  }
+  branchat = getoption("branchat", 0);
+}
+
+/* set the channel and the entities up again under the branch's options, */
+/* and carry the state over to them                                      */
+static void branchsetup(struct branch *b)
+{
+  char *shape = snapshotshape(), *branchshape, *settings;
+  int window, branchwindow, space, limit;
+
+  statelen = 0;
+  snapshotsave();
+  window_layout(&window, &space);
+  options = b->options;
+  noptions = b->noptions;
+  window_layout(&branchwindow, &space);
+  if (branchwindow < window) {
+    /* a smaller window fits the buffers as they are: keep them laid out */
+    /* for the emulator's window and limit the packets in flight instead */
+    limit = (int)getoption("sendwindow", branchwindow);
+    b->options = realloc(b->options, (b->noptions + 2) * sizeof(char *));
+    settings = malloc(64);
+    if (b->options == NULL || settings == NULL) {
+      printf("memory allocation for branches failed.");
+      exit(EXIT_FAILURE);
+    }
+    memmove(b->options + 2, b->options, b->noptions * sizeof(char *));
+    b->options[0] = settings;
+    b->options[1] = settings + 32;
+    sprintf(b->options[0], "window=%d", window);
+    sprintf(b->options[1], "sendwindow=%d", limit < branchwindow ? limit : branchwindow);
+    b->noptions += 2;
+    options = b->options;
+    noptions = b->noptions;
+  }
+  bidirectional = getoption("bidirectional", BIDIRECTIONAL) != 0;
+  quantainit();
+  linkinit(A);
+  linkinit(B);
+  lossinit(A);
+  lossinit(B);
+  delayinit(A);
+  delayinit(B);
+  branchshape = snapshotshape();
+  if (!shapefits(shape, branchshape)) {
+    printf("branch %d (%s) would change the buffers from\n  %s\nto\n  %s\n",
+           thisbranch, b->line, shape, branchshape);
+    exit(EXIT_FAILURE);
+  }
+  A_init();
+  B_init();
+  stateat = statedata;
+  stateend = statedata + statelen;
+  snapshotload();
+  free(shape);
+  free(branchshape);
+}
+
+/* fork a process for each branch; the emulator itself goes on unchanged */
+static void whatif(void)
+{
+  int fd[2], i;
+
+  if (pipe(fd) != 0) {
+    printf("cannot make a pipe for the branches.");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);           /* or the branches would print it again */
+  if (recordf != NULL)
+    fflush(recordf);
+  branchat = -1;
+  branchedat = time;
+  for (i = 0; i < nbranches; i++) {
+    branches[i].pid = fork();
+    if (branches[i].pid < 0) {
+      printf("cannot fork branch %d.", i + 1);
+      exit(EXIT_FAILURE);
+    }
+    if (branches[i].pid == 0) {
+      close(fd[0]);
+      branchfd = fd[1];
+      thisbranch = i + 1;
+      checkpointat = -1;    /* the snapshots and the log are the emulator's to write */
+      recordf = NULL;
+      branchsetup(&branches[i]);
+      if (freopen("/dev/null", "w", stdout) == NULL)
+        exit(EXIT_FAILURE);
+      return;
+    }
+  }
+  close(fd[1]);
+  branchfd = fd[0];
+}
+
+static void branchresult(struct branchresult *r)
+{
+  r->branch = thisbranch;
+  r->time = time;
+  r->delivered = messages_delivered;
+  r->bytes = bytesdelivered;
+  r->resent = packets_resent;
+  r->timeouts = timeouts;
+  r->rtt_samples = rtt_samples;
+  r->rtt_total = rtt_sample_total;
+}
+
+/* a branch ends by sending its results back, not with the report */
+static void branchend(void)
+{
+  struct branchresult r;
+
+  branchresult(&r);
+  if (write(branchfd, &r, sizeof(r)) != (ssize_t)sizeof(r))
+    exit(EXIT_FAILURE);
+  exit(EXIT_SUCCESS);
+}
+
+static void whatifrow(struct branchresult *r, const char *settings)
+{
+  printf("  %6d  %8.3f  %9d  %7d  %8d  %8.3f  %s\n", r->branch,
+         r->time > 0 ? r->bytes / r->time : 0.0, r->delivered, r->resent, r->timeouts,
+         r->rtt_samples > 0 ? r->rtt_total / r->rtt_samples : 0.0, settings);
+}
+
+static void whatifreport(void)
+{
+  struct branchresult r, *results;
+  int i, status;
+
+  if (branchfd < 0) {
+    printf("what-if branches:  none, the simulation ended before time %f\n", branchat);
+    return;
+  }
+  results = calloc(nbranches, sizeof(struct branchresult));
+  if (results == NULL) {
+    printf("memory allocation for branches failed.");
+    exit(EXIT_FAILURE);
+  }
+  while (read(branchfd, &r, sizeof(r)) == (ssize_t)sizeof(r))
+    if (r.branch >= 1 && r.branch <= nbranches)
+      results[r.branch - 1] = r;
+  printf("what-if branches from time %f:\n", branchedat);
+  printf("  branch   goodput  delivered  resends  timeouts  mean RTT  settings\n");
+  branchresult(&r);
+  whatifrow(&r, "(as given)");
+  for (i = 0; i < nbranches; i++) {
+    waitpid(branches[i].pid, &status, 0);
+    if (results[i].branch == 0)
+      printf("  %6d  failed%*s%s\n", i + 1, 46, "", branches[i].line);
+    else
+      whatifrow(&results[i], branches[i].line);
+  }
+  free(results);
+}
+
+/******************* OPTIMISTIC ENGINE ***************/
+static struct evkey evkeyof(struct event *ev)
+{
+  struct evkey k;
+
+  k.time = ev->evtime;
+  k.seq = ev->evseq;
+  k.source = ev->evsource;
+  return k;
+}
+
+static int keybefore(struct evkey a, struct evkey b)
+{
+  if (a.time != b.time)
+    return a.time < b.time;
+  return a.seq < b.seq || (a.seq == b.seq && a.source < b.source);
+}
+
+static void twpost(struct lp *to, struct event *ev, long seq)
+{
+  pthread_mutex_lock(&to->lock);
+  to->inbox = lpgrow(to->inbox, to->ninbox, &to->maxinbox, sizeof(struct twmsg));
+  to->inbox[to->ninbox].ev = ev;
+  to->inbox[to->ninbox].seq = seq;
+  to->inbox[to->ninbox].source = lpid;
+  to->ninbox++;
+  pthread_mutex_unlock(&to->lock);
+}
+
+/* pass ev on to its node at once, noting it in case it has to be */
+/* cancelled; when coasting forward it has been sent already      */
+static void twsend(struct event *ev)
+{
+  struct lp *p = &lps[lpid];
+  struct twoutput *o;
+
+  if (coasting) {
+    evfree(ev);
+    return;
+  }
+  p->out = lpgrow(p->out, p->nout, &p->maxout, sizeof(struct twoutput));
+  o = &p->out[p->nout++];
+  o->sentby = p->lvt;
+  o->seq = ev->evseq;
+  o->node = lpnode(ev);
+  twpost(&lps[o->node], ev, ev->evseq);
+}
+
+static void twsavestate(struct lp *p)
+{
+  struct twstate *s;
+
+  statelen = 0;
+  lpstatesave();
+  p->states = lpgrow(p->states, p->nstates, &p->maxstates, sizeof(struct twstate));
+  s = &p->states[p->nstates++];
+  s->last = p->lvt;
+  s->len = statelen;
+  s->data = malloc(statelen);
+  if (s->data == NULL) {
+    printf("memory allocation for saved state failed.");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(s->data, statedata, statelen);
+  p->sincesave = 0;
+  p->saves++;
+  p->savedbytes += statelen;
+}
+
+/* run the next event, saving the state first if it is time to */
+static void twrunevent(struct lp *p)
+{
+  if (p->sincesave >= stateevery)
+    twsavestate(p);
+  p->lvt = evkeyof(evheap[0]);
+  p->sincesave++;
+  p->executed++;
+  runevent(evheap[0]);
+}
+
+/* undo every event from key to on: go back to the last state saved   */
+/* before it, cancel what the events since sent, and run forward to it */
+static void twrollback(struct lp *p, struct evkey to)
+{
+  struct twstate *s;
+  struct twoutput *o;
+  int i;
+
+  p->rollbacks++;
+  while (p->nstates > 1 && !keybefore(p->states[p->nstates - 1].last, to))
+    free(p->states[--p->nstates].data);
+  s = &p->states[p->nstates - 1];
+  if (!keybefore(s->last, to)) {
+    printf("INTERNAL PANIC: rollback to %f, before the global virtual time\n", to.time);
+    exit(EXIT_FAILURE);
+  }
+  while (p->nout > 0 && !keybefore(p->out[p->nout - 1].sentby, to)) {
+    o = &p->out[--p->nout];
+    twpost(&lps[o->node], NULL, o->seq);
+    p->antimessages++;
+  }
+  stateat = s->data;
+  stateend = s->data + s->len;
+  lpstateload();
+  for (i = 0; i < p->nin; i++)
+    if (!p->in[i].cancelled && keybefore(s->last, evkeyof(p->in[i].ev)))
+      evpush(evclone(p->in[i].ev));
+  p->lvt = s->last;
+  p->sincesave = 0;
+  coasting = 1;
+  while (nevents > 0 && keybefore(evkeyof(evheap[0]), to))
+    twrunevent(p);
+  coasting = 0;
+}
+
+/* take what the other processes sent, rolling back for an event in the */
+/* past or the antimessage of one already run                           */
+static void twreceive(struct lp *p)
+{
+  struct twmsg *msgs;
+  struct evkey k, to;
+  struct event *ev;
+  int i, j, n, max, back = 0;
+
+  pthread_mutex_lock(&p->lock);
+  msgs = p->inbox;
+  n = p->ninbox;
+  max = p->maxinbox;
+  p->inbox = p->spare;
+  p->maxinbox = p->maxspare;
+  p->ninbox = 0;
+  pthread_mutex_unlock(&p->lock);
+  p->spare = msgs;
+  p->maxspare = max;
+  lpreclaim(p);
+
+  for (i = 0; i < n; i++) {
+    if (msgs[i].ev != NULL) {
+      p->in = lpgrow(p->in, p->nin, &p->maxin, sizeof(struct twinput));
+      p->in[p->nin].ev = lpadopt(msgs[i].ev, msgs[i].source);
+      p->in[p->nin++].cancelled = 0;
+      k = evkeyof(msgs[i].ev);
+      if (!keybefore(k, p->lvt))
+        evpush(evclone(msgs[i].ev));
+      else if (!back || keybefore(k, to)) {
+        to = k;
+        back = 1;
+      }
+      continue;
+    }
+    for (j = 0; j < p->nin; j++)
+      if (!p->in[j].cancelled && p->in[j].ev->evsource == msgs[i].source &&
+          p->in[j].ev->evseq == msgs[i].seq)
+        break;
+    if (j == p->nin) {
+      printf("INTERNAL PANIC: antimessage for an event never received\n");
+      exit(EXIT_FAILURE);
+    }
+    p->in[j].cancelled = 1;
+    k = evkeyof(p->in[j].ev);
+    if (keybefore(p->lvt, k)) {   /* not run yet: take it off the list */
+      for (j = 0; j < nevents; j++)
+        if (evheap[j]->evsource == msgs[i].source && evheap[j]->evseq == msgs[i].seq) {
+          ev = evheap[j];
+          removeevent(ev);
+          evfree(ev);
+          break;
+        }
+    } else if (!back || keybefore(k, to)) {
+      to = k;
+      back = 1;
+    }
+  }
+  if (back)
+    twrollback(p, to);
+}
+
+/* free what nothing before the global virtual time gvt can need: the */
+/* states saved before the last one before it, the events received    */
+/* that state has been through, and the record of the events sent     */
+/* before it                                                          */
+static void twfossils(struct lp *p, double gvt)
+{
+  int i, n;
+
+  for (n = 0; n + 1 < p->nstates && p->states[n + 1].last.time < gvt; n++)
+    free(p->states[n].data);
+  if (n > 0) {
+    memmove(p->states, p->states + n, (p->nstates - n) * sizeof(struct twstate));
+    p->nstates -= n;
+  }
+  for (i = 0, n = 0; i < p->nin; i++)
+    if (keybefore(p->states[0].last, evkeyof(p->in[i].ev)))
+      p->in[n++] = p->in[i];
+    else
+      evfree(p->in[i].ev);
+  p->nin = n;
+  for (n = 0; n < p->nout && p->out[n].sentby.time < gvt; n++)
+    ;
+  if (n > 0) {   /* out is still NULL when nothing has been sent */
+    memmove(p->out, p->out + n, (p->nout - n) * sizeof(struct twoutput));
+    p->nout -= n;
+  }
+}
+
+static void *twrun(void *arg)
+{
+  struct lp *p = arg;
+  double gvt = 0;
+  long rounds;
+  int i, n, quiet;
+
+  lpstart(p);
+  p->lvt.time = -HUGE_VAL;
+  p->lvt.seq = 0;
+  p->lvt.source = 0;
+  twsavestate(p);
+  pthread_barrier_wait(&windowend);
+
+  for (rounds = 1;; rounds++) {
+    sem_wait(&running);
+    for (n = 0; n < gvtevents; n++) {
+      twreceive(p);
+      if (nevents == 0 || evheap[0]->evtime >= gvt + optwindow)
+        break;
+      twrunevent(p);
+    }
+    sem_post(&running);
+
+    /* the global virtual time: once no process has anything left to */
+    /* send, the earliest event left                                 */
+    do {
+      pthread_barrier_wait(&windowend);
+      sem_wait(&running);
+      twreceive(p);
+      sem_post(&running);
+      pthread_barrier_wait(&windowend);
+      quiet = 1;
+      for (i = 0; i < nlps; i++) {
+        pthread_mutex_lock(&lps[i].lock);
+        quiet = quiet && lps[i].ninbox == 0;
+        pthread_mutex_unlock(&lps[i].lock);
+      }
+      pthread_barrier_wait(&windowend);
+    } while (!quiet);
+    p->next[0] = nevents > 0 ? evheap[0]->evtime : HUGE_VAL;
+    pthread_barrier_wait(&windowend);
+    gvt = HUGE_VAL;
+    for (i = 0; i < nlps; i++)
+      if (lps[i].next[0] < gvt)
+        gvt = lps[i].next[0];
+    if (gvt == HUGE_VAL)
+      break;
+    twfossils(p, gvt);
+  }
+
+  if (lpid == A)
+    windows = rounds;
+  lpsave(&p->stats);
+  p->flowstats = flowstats;
+  return NULL;
+}
+
+/* run the events init() set up as logical processes, then combine their */
+/* statistics into this thread's                                         */
+static void runparallel(void)
+{
+  struct timespec t0, t1;
+  struct lpstats *s;
+  struct event *ev;
+  struct lp *p;
+  int i, k;
+
+  if (nchanges > 0) {
+    printf("scenarios change the whole channel at once and cannot be run with threads\n");
+    exit(EXIT_FAILURE);
+  }
+  optimistic = getoption("optimistic", 0) != 0;
+  stateevery = (int)getoption("statesave", 16);
+  gvtevents = (int)getoption("gvtevents", 1000);
+  optwindow = getoption("optwindow", 10);
+  if (stateevery < 1 || gvtevents < 1 || optwindow <= 0) {
+    printf("statesave and gvtevents must be at least 1, optwindow above 0\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!optimistic) {
+    lookahead = leastdelay();
+    if (lookahead <= 0) {
+      printf("threads needs every packet to take some time to reach the next node, or optimistic=1\n");
+      exit(EXIT_FAILURE);
+    }
+    lookahead -= lookahead * 1e-9;  /* room for rounding in the arrival times */
+  }
+  nlps = nhops > 0 ? nnodes : 2;
+  lps = calloc(nlps, sizeof(struct lp));
+  if (lps == NULL) {
+    printf("memory allocation for logical processes failed.");
+    exit(EXIT_FAILURE);
+  }
+  while (nevents > 0) {
+    ev = evheap[0];
+    removeevent(ev);
+    p = &lps[lpnode(ev)];
+    p->initial = realloc(p->initial, (p->ninitial + 1) * sizeof(struct event *));
+    if (p->initial == NULL) {
+      printf("memory allocation for logical processes failed.");
+      exit(EXIT_FAILURE);
+    }
+    p->initial[p->ninitial++] = ev;
+  }
+  lpsave(&startstats);
+  if (sem_init(&running, 0, nthreads) != 0 || pthread_barrier_init(&windowend, NULL, nlps) != 0) {
+    printf("cannot set up the parallel engine.");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < nlps; i++)
+    pthread_mutex_init(&lps[i].lock, NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < nlps; i++)
+    if (pthread_create(&lps[i].thread, NULL, optimistic ? twrun : lprun, &lps[i]) != 0) {
+      printf("cannot start logical process %d.", i);
+      exit(EXIT_FAILURE);
+    }
+  for (i = 0; i < nlps; i++)
+    pthread_join(lps[i].thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  walltime = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  lpload(&lps[A].stats);
+  for (k = 0; k < nlps; k++) {
+    s = &lps[k].stats;
+    if (k != A) {
+      LPSTATS(LPMERGE)
+    }
+    for (i = 0; i < nflows; i++) {
+      flowstats[i].offered += lps[k].flowstats[i].offered;
+      flowstats[i].packets += lps[k].flowstats[i].packets;
+      flowstats[i].resent += lps[k].flowstats[i].resent;
+      flowstats[i].delivered += lps[k].flowstats[i].delivered;
+      flowstats[i].bytes += lps[k].flowstats[i].bytes;
+    }
+  }
+}
+
+/* parallelorder=1: each node's count of events made, streams and count */
+/* of messages, swapped in before one of its events runs                 */
+struct lpnodestate {
+  long evinserted;
+  struct rng rngs[2];
+  int nsim;
+};
+
+static struct lpnodestate *lpstates;  /* one for each node */
+
+/* make node the one whose event runs */
+static void lpswitch(int node)
+{
+  struct lpnodestate *s;
+
+  if (node == lpid)
+    return;
+  if (lpid >= 0) {
+    s = &lpstates[lpid];
+    s->evinserted = evinserted;
+    memcpy(s->rngs, rngs, sizeof(rngs));
+    s->nsim = nsim;
+  }
+  s = &lpstates[node];
+  evinserted = s->evinserted;
+  memcpy(rngs, s->rngs, sizeof(rngs));
+  nsim = s->nsim;
+  lpid = node;
+}
+
+/* the node whose process runs an event; arrivals stay where drawn */
+static int lporderof(struct event *ev)
+{
+  return ev->evtype == FROM_LAYER5 ? ev->evsource : lpnode(ev);
+}
+
+/* set the sequential engine up to run the events as the logical */
+/* processes would: the events init() put on the list are put on */
+/* again at their nodes, as lpstart() does, and every node draws */
+/* from the streams its process would                            */
+static void lporderinit(void)
+{
+  struct event **initial;
+  int n, i, k;
+
+  if (nchanges > 0 || recordf != NULL || replaylog != NULL || checkpointat >= 0 ||
+      resumefrom != NULL || nbranches > 0) {
+    printf("parallelorder cannot be used with scenarios, record, replay, checkpoints or branches\n");
+    exit(EXIT_FAILURE);
+  }
+  nlps = nhops > 0 ? nnodes : 2;
+  lpstates = calloc(nlps, sizeof(struct lpnodestate));
+  initial = malloc((nevents + 1) * sizeof(struct event *));
+  if (lpstates == NULL || initial == NULL) {
+    printf("memory allocation for logical processes failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (n = 0; nevents > 0; n++) {
+    initial[n] = evheap[0];
+    removeevent(initial[n]);
+  }
+  for (k = 0; k < nlps; k++) {
+    lpswitch(k);
+    rngseed(&rngs[0], 9999 + 1 + k);
+    rngseed(&rngs[1], 9999);
+    for (i = 0; i < n; i++)
+      if (lpnode(initial[i]) == k)
+        insertevent(initial[i]);
+    if (k == A || (k == B && bidirectional))
+      generate_next_arrival();
+  }
+  free(initial);
+}
+
+static void parallelreport(void)
+{
+  long executed = 0, rollbacks = 0, antimessages = 0, saves = 0;
+  double savedbytes = 0;
+  int i;
+
+  if (nthreads == 0) {
+    printf("parallel engine: %d logical processes run in order on the sequential engine\n", nlps);
+    return;
+  }
+  if (!optimistic)
+    printf("parallel engine: %d logical processes on %d threads, lookahead %f, %ld windows\n",
+           nlps, nthreads < nlps ? nthreads : nlps, lookahead, windows);
+  else {
+    for (i = 0; i < nlps; i++) {
+      executed += lps[i].executed;
+      rollbacks += lps[i].rollbacks;
+      antimessages += lps[i].antimessages;
+      saves += lps[i].saves;
+      savedbytes += lps[i].savedbytes;
+    }
+    printf("parallel engine: %d logical processes on %d threads, optimistic, %ld GVT rounds\n",
+           nlps, nthreads < nlps ? nthreads : nlps, windows);
+    printf("parallel engine: %ld events run for %ld committed, %ld rollbacks, %ld antimessages\n",
+           executed, evprocessed, rollbacks, antimessages);
+    printf("parallel engine: %ld states saved, %.0f bytes each on average\n",
+           saves, saves > 0 ? savedbytes / saves : 0.0);
+  }
+  printf("parallel engine: %ld events in %.3f s of wall time, %.0f per second\n",
+         evprocessed, walltime, walltime > 0 ? evprocessed / walltime : 0);
+}
+
+int main(int argc, char *argv[])
+{
+  struct event *eventptr;
+   
+  int i, j;
+  
+  noptions = argc - 1;
+  options = argv + 1;
+  init();
+  A_init();
+  B_init();
+  checkpointinit();
+  whatifinit();
+  if (nthreads == 0 && lporder)
+    lporderinit();
+  if (nthreads > 0) {
+    runparallel();
+    goto terminate;
+  }
+   
+  while (1) {
+    if (nevents == 0)
+      goto terminate;
+    if (until >= 0 && evheap[0]->evtime >= until)
+      goto terminate;
+    if (tracefrom >= 0 && evheap[0]->evtime >= tracefrom) {
+      TRACE = tracelevel;
+      tracefrom = -1;
+    }
+    if (branchat >= 0 && evheap[0]->evtime >= branchat)
+      whatif();                   /* the branches load the events again */
+    eventptr = evheap[0];         /* get next event to simulate */
+    if (eventptr->evtype == SCENARIO && scenariosleft()) {
+      while (nevents > 0) {       /* only scenario changes are left */
+        eventptr = evheap[0];
+        removeevent(eventptr);
+        free(eventptr);
+      }
+      goto terminate;
+    }
+    if (checkpointat >= 0 && eventptr->evtime >= checkpointat) {
+      checkpoint();
+      if (checkpointstop)
+        goto terminate;
+    }
+    if (lpstates != NULL)
+      lpswitch(lporderof(eventptr));
+    runevent(eventptr);
+  }
+
+ terminate:
+  if (lpstates != NULL)
+    lpswitch(A);                  /* A's count of messages, as threads= reports */
+  if (thisbranch > 0)
+    branchend();
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  if (getoption("backlog", 0) > 0) {
+    printf("number of messages queued in the backlog at A:  %d \n", backlog_queued);
+    printf("backlog high-water mark:  %d messages\n", backlog_highwater);
+    printf("mean backlog queueing delay:  %f (max %f)\n",
+           backlog_queued > 0 ? backlog_delay / backlog_queued : 0.0, backlog_maxdelay);
+  }
+  if (getoption("coalesce", 0) != 0) {
+    printf("number of messages coalesced at A:  %d \n", coalesced_msgs);
+    printf("number of packets saved by coalescing:  %d \n", coalesce_saved);
+    printf("mean latency added by coalescing:  %f \n",
+           coalesced_msgs > 0 ? coalesce_delay / coalesced_msgs : 0.0);
+  }
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (getoption("sack", 0) != 0 || getoptionstr("rto", NULL) != NULL)
+    printf("number of spurious resends (packets B already had):  %d \n", spurious_resends);
+  if (getoptionstr("rto", NULL) != NULL) {
+    printf("number of retransmission timeouts at A:  %d (%s timeout, %f at the end)\n",
+           timeouts, getoptionstr("rto", "fixed"), rto_last);
+    printf("mean measured round trip time:  %f (%d samples)\n",
+           rtt_samples > 0 ? rtt_sample_total / rtt_samples : 0.0, rtt_samples);
+  }
+  if (strcmp(getoptionstr("cc", "none"), "none") != 0) {
+    printf("congestion control:  %s, %d window cuts, cwnd %f at the end\n",
+           getoptionstr("cc", "none"), cwnd_cuts, cwnd_last);
+    printf("time-averaged congestion window:  %f packets (window %d)\n",
+           time > 0 ? (cwnd_area + (time - cwnd_changed) * cwnd_last) / time : 0.0,
+           (int)getoption("window", 6));
+  }
+  if (getoption("nak", 0) != 0) {
+    printf("mean recovery latency (first send to ACK) of resent packets:  %f (%d packets)\n",
+           recovered_timeout + recovered_nak > 0 ?
+           (recovery_timeout_time + recovery_nak_time) / (recovered_timeout + recovered_nak) : 0.0,
+           recovered_timeout + recovered_nak);
+    printf("number of NAKs sent by B:  %d, packets resent for them by A:  %d \n", naks_sent, nak_resends);
+    printf("  first resent after a timeout:  %f (%d packets)\n",
+           recovered_timeout > 0 ? recovery_timeout_time / recovered_timeout : 0.0, recovered_timeout);
+    printf("  first resent after a NAK:  %f (%d packets)\n",
+           recovered_nak > 0 ? recovery_nak_time / recovered_nak : 0.0, recovered_nak);
+  }
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of ACK packets sent by B:  %d \n", acks_sent);
+  if (getoption("delack", bidirectional) != 0)
+    printf("number of ACK packets saved by delayed ACKs:  %d \n", acks_coalesced);
+  if (bidirectional) {
+    printf("number of ACKs piggybacked on data packets:  %d \n", acks_piggybacked);
+    printf("ACK bytes saved by piggybacking:  %ld of %ld (%.2f%%)\n", ackbytes_saved,
+           ackbytes_sent + ackbytes_saved, ackbytes_sent + ackbytes_saved > 0 ?
+           100.0 * ackbytes_saved / (ackbytes_sent + ackbytes_saved) : 0.0);
+  }
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  if (delayset()) {
+    printf("packets B held out of order after each arrival:");
+    for (j = RECVHIST - 1; j > 0 && recv_held[j] == 0; j--)
+      ;
+    for (i = 0; i <= j; i++)
+      printf("  %d: %d", i, recv_held[i]);
+    printf("\n");
+  }
+  if (getoption("latency", 0) != 0) {
+    if (nthreads > 0 || lporder)
+      printf("message latency (A_output to delivery):  not measured by the parallel engine\n");
+    else
+      latencyline("message latency (A_output to delivery)", msg_latency, msg_latency_total,
+                  msg_latency_max);
+    latencyline("head-of-line blocking (time packets were held out of order)", hol_wait,
+                hol_wait_total, hol_wait_max);
+  }
+  printf("mtu: %d payload bytes, message size: %d bytes, header: %d bytes\n", mtu, msgsize, headersize);
+  printf("number of bytes passed to layer 3 (headers and payload):  %ld \n", bytestolayer3);
+  printf("number of bytes lost in the medium:  %ld \n", byteslost);
+  if (getoption("pace", 0) != 0) {
+    endburst();
+    printf("bursts of packets sent by A at one instant (largest %d):", maxburst);
+    for (j = 0; j < NBURSTBINS; j++) {
+      if (j == NBURSTBINS - 1)
+        printf("  >%d: %d", 1 << (j - 1), bursts[j]);
+      else if (j < 2)
+        printf("  %d: %d", 1 << j, bursts[j]);
+      else
+        printf("  %d-%d: %d", (1 << (j - 1)) + 1, 1 << j, bursts[j]);
+    }
+    printf("\n");
+  }
+  if (links[A].rate > 0)
+    linkreport(A, "A->B");
+  if (links[B].rate > 0)
+    linkreport(B, "B->A");
+  if (getoptionstr("loss", NULL) != NULL || getoptionstr("loss_ab", NULL) != NULL ||
+      getoptionstr("loss_ba", NULL) != NULL) {
+    lossreport(&losses[A], "A->B");
+    lossreport(&losses[B], "B->A");
+  }
+  if (nhops > 0)
+    topologyreport();
+  if (delayset()) {
+    delayreport(A);
+    delayreport(B);
+  }
+  if (nchanges > 0)
+    scenarioreport();
+  if (nflows > 1)
+    flowreport();
+  if (nthreads > 0 || lporder)
+    parallelreport();
+  if (resumefrom != NULL || checkpointfile != NULL)
+    checkpointreport();
+  if (nbranches > 0)
+    whatifreport();
+  if (recordf != NULL || replaylog != NULL)
+    replayreport();
+  if (getoption("pace", 0) != 0)
+    printf("number of packets paced at A:  %d, mean wait for a token:  %f\n",
+           paced_packets, paced_packets > 0 ? pace_delay / paced_packets : 0.0);
+  printf("header overhead:  %.2f%% of bytes passed to layer 3\n",
+         bytestolayer3 > 0 ? 100.0 * (bytestolayer3 - payloadtolayer3) / bytestolayer3 : 0.0);
+  printf("number of payload bytes delivered to application:  %ld \n", bytesdelivered);
+  printf("goodput:  %.3f payload bytes per time unit (%.4f messages per time unit)\n",
+         time > 0 ? bytesdelivered / time : 0.0, time > 0 ? messages_delivered / time : 0.0);
+  printf("payload buffers allocated for the medium:  %d \n", nbufs);
+  return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -1,40 +1,132 @@
-extern int TRACE;
-
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
-
-#define   A    0
-#define   B    1
-
-/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
-/* 4 (students' code).  It contains the data (characters) to be delivered */
-/* to layer 5 via the students transport level protocol entities.         */
-struct msg {
-  char data[20];
-};
-
-/* a packet is the data unit passed from layer 4 (students code) to layer */
-/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
-struct pkt {
-  int seqnum;
-  int acknum;
-  int checksum;
-  char payload[20];
-};
-
-/* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
-
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
-
-/* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
-
-/* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern int TRACE;
+
+/* under the parallel engine (threads= option) each logical process keeps */
+/* its own statistics, on a thread of its own                              */
+#define LPLOCAL __thread
+
+/* statistics updated by GBN */
+extern LPLOCAL int total_ACKs_received;
+extern LPLOCAL int packets_resent;       /* count of the number of packets resent  */
+extern LPLOCAL int new_ACKs;      /* count of the number of acks correctly received */
+extern LPLOCAL int packets_received;  /* count of the packets received by receiver */
+extern LPLOCAL int window_full; /* count of the number of messages dropped due to full window */
+extern LPLOCAL int backlog_queued;     /* messages that waited in A's backlog for the window */
+extern LPLOCAL int backlog_highwater;  /* largest number of messages in the backlog at once */
+extern LPLOCAL double backlog_delay;   /* total time messages spent in the backlog */
+extern LPLOCAL double backlog_maxdelay; /* longest time a message spent in the backlog */
+extern LPLOCAL int coalesced_msgs;     /* messages packed into a coalesced batch at A */
+extern LPLOCAL int coalesce_saved;     /* packets saved by coalescing */
+extern LPLOCAL double coalesce_delay;  /* total time messages waited for their batch to be sent */
+extern LPLOCAL int acks_sent;          /* ACK packets sent by B */
+extern LPLOCAL int acks_coalesced;     /* ACK packets saved by combining delayed ACKs */
+extern LPLOCAL int acks_piggybacked;   /* delayed ACKs carried on a data packet instead */
+extern LPLOCAL long ackbytes_sent;     /* bytes of standalone ACK packets */
+extern LPLOCAL long ackbytes_saved;    /* bytes of the ACK packets piggybacking made unnecessary */
+extern LPLOCAL int spurious_resends;   /* packets B received again after already having them */
+extern LPLOCAL int naks_sent;          /* NAK packets sent by B */
+extern LPLOCAL int nak_resends;        /* packets A resent in answer to a NAK */
+extern LPLOCAL int recovered_nak;      /* lost packets whose first resend was NAK-triggered */
+extern LPLOCAL int recovered_timeout;  /* lost packets whose first resend was a timeout */
+extern LPLOCAL double recovery_nak_time;     /* total first-send-to-ACK time of those */
+extern LPLOCAL double recovery_timeout_time;
+extern LPLOCAL int timeouts;           /* retransmission timeouts at A */
+extern LPLOCAL int rtt_samples;        /* round trip times measured on packets never resent */
+extern LPLOCAL double rtt_sample_total;
+extern LPLOCAL double rto_last;        /* retransmission timeout in force at the end */
+extern LPLOCAL int cwnd_cuts;          /* congestion window reductions at A */
+extern LPLOCAL double cwnd_area;       /* integral of cwnd over time up to cwnd_changed */
+extern LPLOCAL double cwnd_changed;    /* time cwnd last changed */
+extern LPLOCAL double cwnd_last;       /* congestion window at the end */
+extern LPLOCAL int paced_packets;      /* packets A sent through the pacer */
+extern LPLOCAL double pace_delay;      /* total time they waited for a token */
+#define RECVHIST 64            /* most packets B can hold out of order, plus one */
+extern LPLOCAL int recv_held[RECVHIST]; /* packets B holds out of order, counted after each arrival */
+
+/* with latency=1, times are counted in log-bucketed histograms: LATSUB   */
+/* buckets to each doubling from 2^LATMINEXP, so a percentile read back   */
+/* is within 1/LATSUB of the time measured                                */
+#define LATSUB 16
+#define LATMINEXP (-8)
+#define LATBUCKETS (32 * LATSUB)
+extern LPLOCAL int msg_latency[LATBUCKETS]; /* messages by time from A_output() to delivery to layer 5 */
+extern LPLOCAL double msg_latency_total;
+extern LPLOCAL double msg_latency_max;
+extern LPLOCAL int hol_wait[LATBUCKETS];    /* packets by time held out of order, waiting for the gap */
+extern LPLOCAL double hol_wait_total;
+extern LPLOCAL double hol_wait_max;
+
+#define   A    0
+#define   B    1
+
+#define MAXMTU 9216      /* largest payload a packet may carry (jumbo frame) */
+#define MAXMSG (64*1024*1024) /* largest message layer 5 will pass down */
+#define HEADERSIZE 20    /* bytes taken by the seqnum, acknum, checksum, length and flags fields */
+#define CONNIDSIZE 4     /* bytes taken by the connid field, sent only with more than one flow */
+
+extern int mtu;          /* payload bytes layer 3 will carry in one packet, set by the mtu= option */
+extern int msgsize;      /* bytes in each message from layer 5, set by the msgsize= option */
+extern int nflows;       /* concurrent connections between A and B, set by the flows= option */
+extern int headersize;   /* HEADERSIZE, plus CONNIDSIZE with more than one flow */
+
+/* per-flow statistics, indexed by connection ID */
+struct flowstats {
+  int offered;           /* messages layer 5 gave the flow */
+  int packets;           /* packets of the flow passed to layer 3, data and ACKs */
+  int resent;            /* data packets resent */
+  int delivered;         /* messages delivered to the application */
+  long bytes;            /* payload bytes delivered to the application */
+};
+extern LPLOCAL struct flowstats *flowstats;
+
+/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
+/* 4 (students' code).  It contains the data (characters) to be delivered */
+/* to layer 5 via the students transport level protocol entities.         */
+/* The data belongs to the caller and is only valid during the call.      */
+struct msg {
+  int length;            /* number of bytes in data */
+  int connid;            /* connection the message is sent on, 0 to flows-1 */
+  char *data;
+};
+
+/* a packet is the data unit passed from layer 4 (students code) to layer */
+/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
+/* students must follow. The payload holds length bytes (at most mtu)    */
+/* and may be NULL when length is 0.  Layer 3 copies the payload, so the  */
+/* sender keeps ownership of its buffer.                                  */
+struct pkt {
+  int seqnum;
+  int acknum;
+  int checksum;
+  int length;
+  int flags;             /* protocol-defined bits, e.g. segmentation marks */
+  int connid;            /* connection the packet belongs to */
+  char *payload;
+};
+
+/* send to A or B (int), packet to send */
+extern void tolayer3(int, struct pkt);  
+
+/* deliver to A or B (int), data to deliver, number of bytes, connection */
+extern void tolayer5(int, char *, int, int);
+
+/* start timer at A or B (int), increment */
+extern void starttimer(int, double);       
+
+/* stop timer at A or B (int) */
+extern void stoptimer(int);               
+
+/* current simulation time */
+extern double simtime(void);
+
+/* count a time in one of the latency histograms */
+extern void latency_add(int *, double);
+
+/* state saving, for the optimistic engine's rollbacks and checkpoints: */
+/* the state is written with statesave() and read back in the same     */
+/* order with stateload()                                               */
+extern void statesave(const void *, size_t);
+extern void stateload(void *, size_t);
+
+/* look up a name=value option given on the command line, or return the default */
+extern double getoption(const char *, double);
+extern const char *getoptionstr(const char *, const char *);
@@ -1,277 +1,1878 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include "emulator.h"
-#include "sr.h"
-#include <string.h>
-
-/* ******************************************************************
-   Go Back N protocol.  Adapted from J.F.Kurose
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications: 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - fixed C style to adhere to current programming style
-   - added GBN implementation
-**********************************************************************/
-
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
-#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
-
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-
-#define RECV_WINDOWSIZE 6
-
-static struct pkt recv_buffer[RECV_WINDOWSIZE];
-static int recv_base = 0;
-static int received[RECV_WINDOWSIZE];
-static bool acked[SEQSPACE];
-
-int ComputeChecksum(struct pkt packet)
-{
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
-}
-
-bool IsCorrupted(struct pkt packet)
-{
-  if (packet.checksum == ComputeChecksum(packet))
-    return (false);
-  else
-    return (true);
-}
-
-static struct pkt buffer[SEQSPACE];
-static bool acked[SEQSPACE];
-static int window_base = 0;
-static int windowcount;
-static int A_nextseqnum;
-
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{
-    struct pkt sendpkt;
-    int i;
-
-    if (windowcount < WINDOWSIZE) {
-        if (TRACE > 1)
-        printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-        sendpkt.seqnum = A_nextseqnum;
-        sendpkt.acknum = NOTINUSE;
-        for ( i=0; i<20 ; i++ ) 
-            sendpkt.payload[i] = message.data[i];
-        sendpkt.checksum = ComputeChecksum(sendpkt);
-
-        buffer[sendpkt.seqnum] = sendpkt;
-        acked[sendpkt.seqnum] = false;
-        windowcount++;
-
-        if (TRACE > 0)
-            printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-        tolayer3(A, sendpkt);
-
-        if (windowcount == 1)
-            starttimer(A,RTT);
-
-        A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
-    } else {
-        if (TRACE > 0)
-            printf("----A: New message arrives, send window is full\n");
-        window_full++;
-    }
-}
-
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
-{
-    int i;
-    int win_start;
-    int win_end;
-    bool in_window;
-    
-    if (!IsCorrupted(packet)) {
-        if (TRACE > 0)
-            printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-        total_ACKs_received++;
-
-        win_start = window_base;
-        win_end = (window_base + WINDOWSIZE) % SEQSPACE;
-        in_window = (win_start < win_end) ?
-                         (packet.acknum >= win_start && packet.acknum < win_end) :
-                         (packet.acknum >= win_start || packet.acknum < win_end);
-
-        if (!in_window) {
-            if (TRACE > 2)
-                printf("----A: ACK %d is outside window [%d, %d), ignored\n", packet.acknum, win_start, win_end);
-            return;
-        }
-
-        if (!acked[packet.acknum]) {
-            if (TRACE > 0)
-                printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-            acked[packet.acknum] = true;
-            new_ACKs++;
-
-            while (acked[window_base]) {
-                acked[window_base] = false;
-                window_base = (window_base + 1) % SEQSPACE;
-                windowcount--;
-            }
-
-            stoptimer(A);
-            for (i = 0; i < SEQSPACE; i++) {
-                int seq = (window_base + i) % SEQSPACE;
-                if (!acked[seq] && i < windowcount) {
-                    starttimer(A, RTT);
-                    break;
-                }
-            }
-        } else {
-            if (TRACE > 0)
-                printf("----A: duplicate ACK received, do nothing!\n");
-        }
-    } else {
-        if (TRACE > 0)
-            printf("----A: corrupted ACK is received, do nothing!\n");
-    }
-}
-
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
-{
-    int i;
-    if (TRACE > 0)
-        printf("----A: time out,resend packets!\n");
-
-    for (i = 0; i < windowcount; i++) {
-        int seq = (window_base + i) % SEQSPACE;
-        if (!acked[seq]) {
-            if (TRACE > 0)
-                printf("---A: resending packet %d\n", buffer[seq].seqnum);
-            tolayer3(A, buffer[seq]);
-            packets_resent++;
-            starttimer(A, RTT);
-            break;
-        }
-    }
-}
-
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-    int i;
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowcount = 0;
-
-  for (i = 0; i < SEQSPACE; i++) {
-        acked[i] = false;
-    }
-}
-
-/********* Receiver (B)  variables and procedures ************/
-
-/*static int expectedseqnum; *//* the sequence number expected next by the receiver */
-static int B_nextseqnum;
-
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-/* called from layer 3, when a packet arrives for layer 4 at B */
-void B_input(struct pkt packet)
-{
-    struct pkt sendpkt;
-    int i;
-    int seqnum = packet.seqnum;
-    int rel_pos = (seqnum - recv_base + SEQSPACE) % SEQSPACE;
-
-
-    sendpkt.seqnum = B_nextseqnum;
-    B_nextseqnum = (B_nextseqnum + 1) % 2;
-    for (i = 0; i < 20; i++) 
-        sendpkt.payload[i] = '0';  
-
-    if (!IsCorrupted(packet) && rel_pos < RECV_WINDOWSIZE) {
-        if (TRACE > 0)
-            printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-        if (!received[rel_pos]) {
-            recv_buffer[rel_pos] = packet;
-            received[rel_pos] = 1;
-            if (TRACE > 2)
-                printf("----B: Caching package %d to location %d\n", seqnum, rel_pos);
-            }
-            sendpkt.acknum = seqnum;
-        if (TRACE > 2)
-            printf("----B: Send ACK %d\n", seqnum);
-    }
-    else {
-        if (TRACE > 0)
-            printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-        sendpkt.acknum = seqnum;
-    }
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    tolayer3(B, sendpkt);
-
-    while (received[0]) {
-        tolayer5(B, recv_buffer[0].payload);
-        if (TRACE > 2)
-          printf("----B: Delivering package %d to layer 5\n", recv_base);
-        packets_received++;
-    
-        for (i = 0; i < RECV_WINDOWSIZE - 1; i++) {
-          received[i] = received[i + 1];
-          recv_buffer[i] = recv_buffer[i + 1];
-        }
-        received[RECV_WINDOWSIZE - 1] = 0;
-        recv_base = (recv_base + 1) % SEQSPACE;
-        
-        if (TRACE > 2)
-          printf("----B: Receive window slides to base number %d\n", recv_base);
-    }
-}
-
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
-{
-    recv_base = 0;
-    memset(received, 0, sizeof(received));
-    B_nextseqnum = 1;
-}
-
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
-
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
-{
-}
-
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
-{
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "sr.h"
+#include <string.h>
+
+/* ******************************************************************
+   Go Back N protocol.  Adapted from J.F.Kurose
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+
+   Modifications: 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - fixed C style to adhere to current programming style
+   - added GBN implementation
+**********************************************************************/
+
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#define MAXWINDOW 64    /* largest window the window= option may configure */
+#define MAXSEQSPACE 1024  /* largest sequence space the seqspace= option may configure */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+
+#define SEG_MORE 1      /* flags bit: more segments of the same message follow */
+#define SEG_BATCH 2     /* flags bit: payload holds several coalesced messages */
+#define BATCH_HDR 2     /* bytes of length prefix before each coalesced message */
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+
+/* the maximum number of buffered unacked packets, at A and at B (window=) */
+static int windowsize;
+/* the most packets a sender has in flight (sendwindow=, at most the window) */
+static int sendwindow;
+/* selective repeat needs a sequence space of at least twice the window */
+/* (seqspace= may make it larger)                                      */
+static int seqspace;
+
+/* with bidirectional=1 both entities send data, and each runs a sender and */
+/* a receiver; otherwise A only sends and B only receives                   */
+static bool bidirectional;
+
+/* each entity has a single emulator timer; the logical timers below share */
+/* it and the emulator timer is always set for the earliest deadline        */
+#define TIMER_RETX 0        /* retransmission of the oldest unacked packet */
+#define TIMER_FLUSH 1       /* flush of the coalescing buffer */
+#define TIMER_DELACK 2      /* delayed ACK at the receiver */
+#define TIMER_NAK 3         /* NAK held back by pacing at the receiver */
+#define TIMER_PACE 4        /* next token of the sender's pacing bucket */
+#define NTIMERS 5
+
+/* the logical timers of one flow at one entity.  The flows of an entity */
+/* with a timer running sit in a heap ordered by their earliest deadline */
+struct timerset {
+    int entity;                 /* A or B */
+    int flow;
+    double deadline[NTIMERS];   /* absolute expiry time, -1 when stopped */
+    double due;                 /* earliest deadline, -1 when none is running */
+    int heappos;                /* index in the entity's heap, -1 when not in it */
+};
+
+static struct timerset *timersets[2];   /* nflows per entity */
+static struct timerset **timerheap[2];
+static int ntimerheap[2];
+static struct timerset **duesets[2];    /* flows taken off the heap by an interrupt */
+static double armed[2] = {-1, -1};      /* expiry the emulator timer is set for */
+
+static bool timerbefore(struct timerset *a, struct timerset *b)
+{
+    return a->due < b->due || (a->due == b->due && a->flow < b->flow);
+}
+
+static void heapput(struct timerset **heap, int i, struct timerset *t)
+{
+    heap[i] = t;
+    t->heappos = i;
+}
+
+/* move t from heap index i to where the heap order wants it */
+static void heapsift(struct timerset **heap, int n, int i)
+{
+    struct timerset *t = heap[i];
+    int child;
+
+    while (i > 0 && timerbefore(t, heap[(i - 1) / 2])) {
+        heapput(heap, i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    for (;;) {
+        child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && timerbefore(heap[child + 1], heap[child]))
+            child++;
+        if (!timerbefore(heap[child], t))
+            break;
+        heapput(heap, i, heap[child]);
+        i = child;
+    }
+    heapput(heap, i, t);
+}
+
+static void heapremove(struct timerset *t)
+{
+    struct timerset **heap = timerheap[t->entity];
+    int i = t->heappos;
+
+    t->heappos = -1;
+    if (i != --ntimerheap[t->entity]) {
+        heapput(heap, i, heap[ntimerheap[t->entity]]);
+        heapsift(heap, ntimerheap[t->entity], i);
+    }
+}
+
+/* point the emulator timer of A or B at the earliest logical deadline */
+static void rearm_entity(int AorB)
+{
+    double earliest = ntimerheap[AorB] > 0 ? timerheap[AorB][0]->due : -1;
+
+    if (earliest == armed[AorB])
+        return;
+    if (armed[AorB] >= 0)
+        stoptimer(AorB);
+    if (earliest >= 0)
+        starttimer(AorB, earliest - simtime());
+    armed[AorB] = earliest;
+}
+
+/* recompute when the timers of t are next due and requeue it */
+static void rearm(struct timerset *t)
+{
+    double earliest = -1;
+    int i;
+
+    for (i = 0; i < NTIMERS; i++)
+        if (t->deadline[i] >= 0 && (earliest < 0 || t->deadline[i] < earliest))
+            earliest = t->deadline[i];
+    t->due = earliest;
+    if (t->heappos >= 0 && earliest < 0)
+        heapremove(t);
+    else if (t->heappos >= 0)
+        heapsift(timerheap[t->entity], ntimerheap[t->entity], t->heappos);
+    else if (earliest >= 0) {
+        heapput(timerheap[t->entity], ntimerheap[t->entity]++, t);
+        heapsift(timerheap[t->entity], ntimerheap[t->entity], t->heappos);
+    }
+    rearm_entity(t->entity);
+}
+
+static void settimer(struct timerset *t, int which, double increment)
+{
+    t->deadline[which] = simtime() + increment;
+    rearm(t);
+}
+
+static void canceltimer(struct timerset *t, int which)
+{
+    t->deadline[which] = -1;
+    rearm(t);
+}
+
+static bool timerrunning(struct timerset *t, int which)
+{
+    return t->deadline[which] >= 0;
+}
+
+/* called from the timer interrupt: returns the expiry the emulator timer was */
+/* set for.  Every logical timer due by then has expired; compare against     */
+/* that rather than the event time, which may differ from it by rounding.    */
+static double timerfired(int AorB)
+{
+    double fired = armed[AorB];
+
+    armed[AorB] = -1;
+    return fired;
+}
+
+/* true, and the timer stopped, if logical timer which expired by fired */
+static bool expired(struct timerset *t, int which, double fired)
+{
+    if (t->deadline[which] < 0 || t->deadline[which] > fired)
+        return false;
+    t->deadline[which] = -1;
+    return true;
+}
+
+/* the timer tables of A or B, all stopped to begin with */
+static void timers_init(int AorB)
+{
+    int i, j;
+
+    timersets[AorB] = malloc(nflows * sizeof(struct timerset));
+    timerheap[AorB] = malloc(nflows * sizeof(struct timerset *));
+    duesets[AorB] = malloc(nflows * sizeof(struct timerset *));
+    if (timersets[AorB] == NULL || timerheap[AorB] == NULL || duesets[AorB] == NULL) {
+        printf("memory allocation for timers failed.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nflows; i++) {
+        timersets[AorB][i].entity = AorB;
+        timersets[AorB][i].flow = i;
+        for (j = 0; j < NTIMERS; j++)
+            timersets[AorB][i].deadline[j] = -1;
+        timersets[AorB][i].due = -1;
+        timersets[AorB][i].heappos = -1;
+    }
+    ntimerheap[AorB] = 0;
+    armed[AorB] = -1;
+}
+
+/* ACK_MULTI ACKs acknowledge every seqnum set in a bitmap carried as payload; */
+/* ACK_SACK ACKs carry B's recv_base as acknum, acknowledging everything     */
+/* before it, and a bitmap of the packets buffered in recv_buffer after it   */
+#define ACK_MULTI 4     /* flags bit: payload is a bitmap of acknowledged seqnums */
+#define ACK_SACK 8      /* flags bit: cumulative acknum plus receive bitmap */
+#define PKT_NAK 16      /* flags bit: payload is a bitmap of seqnums B is missing */
+#define PKT_ACK 32      /* flags bit: data packet whose acknum is a cumulative ACK */
+#define MAXACKMAP ((MAXSEQSPACE + 7) / 8)
+static int ackmapsize;  /* bytes in a bitmap of seqspace bits */
+
+int ComputeChecksum(struct pkt packet)
+{
+  int checksum = 0;
+  int i;
+
+  checksum = packet.seqnum;
+  checksum += packet.acknum;
+  checksum += packet.length;
+  checksum += packet.flags;
+  checksum += packet.connid;
+  for ( i=0; i<packet.length; i++ ) 
+    checksum += (int)(packet.payload[i]);
+
+  return checksum;
+}
+
+bool IsCorrupted(struct pkt packet)
+{
+  if (packet.checksum == ComputeChecksum(packet))
+    return (false);
+  else
+    return (true);
+}
+
+/* allocate one mtu-sized payload buffer per slot, once, at init time */
+static void allocpayloads(char **bufs, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        bufs[i] = malloc(mtu);
+        if (bufs[i] == NULL) {
+            printf("memory allocation for payload buffers failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* how a lost packet was recovered, to compare NAK and timeout latency */
+#define RECOVER_NONE 0
+#define RECOVER_TIMEOUT 1
+#define RECOVER_NAK 2
+
+/* messages that arrive while the window is full wait in a bounded ring */
+/* (backlog= option, 0 disables it) and are drained as ACKs open slots  */
+#define OVERFLOW_TAIL 0   /* full backlog drops the arriving message */
+#define OVERFLOW_HEAD 1   /* full backlog drops its oldest message to make room */
+
+struct backlog_entry {
+    char *data;              /* MSGBUFSIZE bytes, allocated on first use */
+    int length;
+    int flags;               /* SEG_BATCH for a coalesced batch */
+    int nmsgs;               /* layer 5 messages held, more than 1 for a batch */
+    double enqueued;         /* time the message arrived from layer 5 */
+};
+
+/* what a sender keeps for each seqnum */
+struct slot {
+    struct pkt packet;              /* payload points at mtu bytes of the slot's own */
+    bool acked;
+    bool unsent;                    /* queued for its first transmission */
+    bool inpaceq;
+    int recovered_by;               /* what triggered its first resend */
+    double sent_at;                 /* first transmission */
+    double queued_at;               /* when it joined the pacing queue */
+    long sentas;                    /* value of sendcount when it was sent */
+};
+
+/* the sending half of one flow at an entity: A's, and with bidirectional=1 */
+/* also B's.  The slots of all of an entity's flows are one table           */
+struct sender {
+    int entity;                     /* A or B */
+    int connid;                     /* the flow, carried in every packet */
+    struct timerset *timers;
+    struct slot *slots;             /* seqspace of them */
+    int window_base;
+    int windowcount;
+    int nextseqnum;
+
+    double rto;                     /* current timeout, including backoff */
+    double srtt;                    /* smoothed round trip time, -1 before the first sample */
+    double rttvar;                  /* round trip time variation */
+
+    double cwnd;                    /* congestion window, in packets */
+    double ssthresh;                /* slow start threshold */
+    long sendcount;                 /* packets sent for the first time so far */
+    long reno_recover;              /* sendcount at the last reno cut */
+
+    double tokens;                  /* pacing bucket */
+    double tokens_at;               /* time tokens was last brought up to date */
+    int *paceq;                     /* seqspace seqnums waiting for a token, oldest first */
+    int paceq_head;
+    int paceq_count;
+
+    char *pending;                  /* copy of the message being segmented */
+    int pending_len;                /* its length, 0 when no message is pending */
+    int pending_off;                /* offset of the first segment not yet sent */
+    int pending_flags;
+
+    struct backlog_entry *backlog;
+    int backlog_head;               /* oldest message */
+    int backlog_count;
+
+    char *batch;                    /* coalescing buffer */
+    int batch_len;
+    int batch_count;                /* messages in the batch */
+    double batch_arrivals;          /* sum of their arrival times, for the added latency */
+
+    double *msgtimes;               /* arrival times of messages not yet delivered, oldest first */
+    int msgtimes_head;
+    int msgtimes_count;
+    int msgtimes_size;
+};
+
+/* the receiving half of one flow at an entity: B's, and with */
+/* bidirectional=1 also A's                                     */
+struct receiver {
+    int entity;                     /* A or B */
+    int connid;
+    struct timerset *timers;
+    struct pkt recv_buffer[MAXWINDOW];
+    char *recv_payloads[MAXWINDOW]; /* mtu-sized storage behind recv_buffer */
+    int recv_base;
+    int received[MAXWINDOW];
+    double held_at[MAXWINDOW];      /* when an out-of-order packet was put in recv_buffer */
+    int nextseqnum;                 /* alternating seqnum of ACK packets */
+
+    double *naked_at;               /* when each seqnum was last NAKed, -1 never */
+    char nakmap[MAXACKMAP];         /* seqnums waiting for the pacing to allow a NAK */
+    bool nakwaiting;
+    double lastnak;                 /* when the last NAK packet went out */
+
+    char ackmap[MAXACKMAP];         /* seqnums awaiting an ACK */
+    int ackcount;                   /* arrivals covered by ackmap */
+    int acklast;                    /* most recent seqnum put in ackmap */
+
+    char *appbuf;                   /* segments are reassembled here */
+    int appfill;                    /* bytes of the current message reassembled so far */
+    bool appoverflow;               /* current message is larger than appbuf, discard it */
+};
+
+/* nflows of each per entity, indexed by connection ID */
+static struct sender *senders[2];
+static struct receiver *receivers[2];
+
+/* retransmission timeout.  rto=fixed keeps it at RTT; rto=adaptive runs the */
+/* Jacobson/Karels estimator on packets that were never resent (Karn) and    */
+/* doubles the timeout on every expiry until the next valid sample           */
+#define RTO_FIXED 0
+#define RTO_ADAPTIVE 1
+static int rto_policy;
+static double rto_min;
+static double rto_max;
+
+/* the timeout and congestion window statistics follow A's first flow */
+static bool reported(struct sender *s)
+{
+    return s->entity == A && s->connid == 0;
+}
+
+/* fold one round trip time sample into srtt/rttvar and recompute rto */
+static void rtt_sample(struct sender *s, double r)
+{
+    rtt_samples++;
+    rtt_sample_total += r;
+    if (rto_policy != RTO_ADAPTIVE)
+        return;
+    if (s->srtt < 0) {
+        s->srtt = r;
+        s->rttvar = r / 2;
+    } else {
+        s->rttvar = 0.75 * s->rttvar + 0.25 * (s->srtt > r ? s->srtt - r : r - s->srtt);
+        s->srtt = 0.875 * s->srtt + 0.125 * r;
+    }
+    s->rto = s->srtt + 4 * s->rttvar;
+    if (s->rto < rto_min)
+        s->rto = rto_min;
+    if (s->rto > rto_max)
+        s->rto = rto_max;
+    if (reported(s))
+        rto_last = s->rto;
+}
+
+/* exponential backoff after a timeout */
+static void rto_backoff(struct sender *s)
+{
+    if (rto_policy != RTO_ADAPTIVE)
+        return;
+    s->rto *= 2;
+    if (s->rto > rto_max)
+        s->rto = rto_max;
+    if (reported(s))
+        rto_last = s->rto;
+}
+
+/* congestion control.  A controller sees ACK and loss events at a sender  */
+/* and keeps a congestion window cwnd in packets; the sender keeps at most  */
+/* min(cwnd, window) packets outstanding.  New controllers are added to the */
+/* controllers table and chosen with cc=<name>                              */
+#define LOSS_TIMEOUT 0      /* the retransmission timer expired */
+#define LOSS_NAK 1          /* the receiver reported a gap */
+
+struct congestion_control {
+    const char *name;
+    void (*init)(struct sender *s);
+    void (*acked)(struct sender *s, int npackets);  /* an ACK acknowledged npackets new packets */
+    void (*lost)(struct sender *s, int kind);       /* a loss was detected */
+};
+
+static void set_cwnd(struct sender *s, double w)
+{
+    if (reported(s)) {
+        cwnd_area += (simtime() - cwnd_changed) * s->cwnd;
+        cwnd_changed = simtime();
+        cwnd_last = w;
+    }
+    s->cwnd = w;
+}
+
+/* cc=none: no congestion window, only the configured window limits A */
+static void none_init(struct sender *s)
+{
+    set_cwnd(s, MAXWINDOW);
+    s->ssthresh = MAXWINDOW;
+}
+
+static void none_acked(struct sender *s, int npackets)
+{
+    (void)s;
+    (void)npackets;
+}
+
+static void none_lost(struct sender *s, int kind)
+{
+    (void)s;
+    (void)kind;
+}
+
+/* cc=reno: slow start to ssthresh, then one packet per window of ACKs.  A   */
+/* timeout drops back to one packet; NAK losses halve the window at most once */
+/* per window of data (packets sent before the cut do not cut it again)      */
+static void reno_init(struct sender *s)
+{
+    set_cwnd(s, getoption("initcwnd", 1));
+    s->ssthresh = windowsize;
+    s->reno_recover = 0;
+}
+
+static void reno_acked(struct sender *s, int npackets)
+{
+    double w = s->cwnd;
+
+    while (npackets-- > 0)
+        w += w < s->ssthresh ? 1 : 1 / w;
+    if (w > windowsize)
+        w = windowsize;   /* growing past the window would not send more */
+    set_cwnd(s, w);
+}
+
+static void reno_lost(struct sender *s, int kind)
+{
+    if (kind == LOSS_NAK && s->slots[s->window_base].sentas < s->reno_recover)
+        return;     /* already cut for this window */
+    s->ssthresh = s->cwnd / 2 < 2 ? 2 : s->cwnd / 2;
+    set_cwnd(s, kind == LOSS_TIMEOUT ? 1 : s->ssthresh);
+    s->reno_recover = s->sendcount;
+    if (reported(s))
+        cwnd_cuts++;
+    if (TRACE > 1)
+        printf("----%c: %s, cwnd cut to %f\n", 'A' + s->entity,
+               kind == LOSS_TIMEOUT ? "timeout" : "NAK", s->cwnd);
+}
+
+static const struct congestion_control controllers[] = {
+    {"none", none_init, none_acked, none_lost},
+    {"reno", reno_init, reno_acked, reno_lost},
+};
+static const struct congestion_control *cc;
+
+/* the number of packets the sender may have outstanding right now */
+static int send_limit(struct sender *s)
+{
+    int w = sendwindow;
+
+    if (s->cwnd < w)
+        w = (int)s->cwnd;
+    return w < 1 ? 1 : w;
+}
+
+/* true if seq is in the send window [window_base, window_base + windowsize) */
+static bool in_send_window(struct sender *s, int seq)
+{
+    int win_start = s->window_base;
+    int win_end = (s->window_base + windowsize) % seqspace;
+
+    if (seq < 0 || seq >= seqspace)
+        return false;   /* ACK for a packet whose seqnum was corrupted */
+    return (win_start < win_end) ?
+                (seq >= win_start && seq < win_end) :
+                (seq >= win_start || seq < win_end);
+}
+
+/* with bidirectional=1 every data packet carries the recv_base of its    */
+/* entity's receiver as a cumulative ACK.  A delayed ACK it covers in full */
+/* is not sent; one that also acknowledges packets held out of order is    */
+/* left for those alone                                                    */
+static int piggyback(struct receiver *r)
+{
+    int seq;
+    int held = 0;
+
+    if (r->ackcount == 0)
+        return r->recv_base;
+    for (seq = 0; seq < seqspace; seq++) {
+        if (!(r->ackmap[seq / 8] & (1 << (seq % 8))))
+            continue;
+        if ((seq - r->recv_base + seqspace) % seqspace < windowsize)
+            held++;
+        else
+            r->ackmap[seq / 8] &= (char)~(1 << (seq % 8));
+    }
+    if (held == 0) {
+        canceltimer(r->timers, TIMER_DELACK);
+        if (TRACE > 2)
+            printf("----%c: ACK for %d arrivals piggybacked on data\n", 'A' + r->entity, r->ackcount);
+        acks_coalesced += r->ackcount - 1;
+        acks_piggybacked++;
+        ackbytes_saved += headersize + ackmapsize;
+    }
+    r->ackcount = held;
+    return r->recv_base;
+}
+
+/* hand packet seq to layer 3, with the entity's ACK on it when bidirectional */
+static void transmit(struct sender *s, int seq)
+{
+    struct pkt *packet = &s->slots[seq].packet;
+
+    if (bidirectional) {
+        packet->acknum = piggyback(&receivers[s->entity][s->connid]);
+        packet->flags |= PKT_ACK;
+        packet->checksum = ComputeChecksum(*packet);
+    }
+    tolayer3(s->entity, *packet);
+}
+
+/* with pace=1, data packets pass through a token bucket on their way to */
+/* layer 3, so a window that opens all at once does not put them on the  */
+/* channel back to back.  Tokens accrue at pacerate packets per time unit,  */
+/* or at the current window per smoothed RTT when pacerate is 0, and the    */
+/* bucket holds at most paceburst of them                                   */
+#define PACE_SLACK 1e-9     /* rounding allowed when a token is just complete */
+static bool pace;
+static double pacerate;
+static double paceburst;
+
+static double pace_rate(struct sender *s)
+{
+    if (pacerate > 0)
+        return pacerate;
+    return send_limit(s) / (s->srtt > 0 ? s->srtt : RTT);
+}
+
+/* send the packets the bucket has tokens for, then wait for the next token. */
+/* now is the current time, or the deadline when called from the timer      */
+static void pace_release(struct sender *s, double now)
+{
+    int seq;
+
+    if (now > s->tokens_at) {
+        s->tokens += (now - s->tokens_at) * pace_rate(s);
+        if (s->tokens > paceburst)
+            s->tokens = paceburst;
+        s->tokens_at = now;
+    }
+    while (s->paceq_count > 0 && s->tokens >= 1 - PACE_SLACK) {
+        seq = s->paceq[s->paceq_head];
+        s->paceq_head = (s->paceq_head + 1) % seqspace;
+        s->paceq_count--;
+        s->slots[seq].inpaceq = false;
+        if (!in_send_window(s, seq) || s->slots[seq].acked)
+            continue;   /* acknowledged while it waited */
+        s->tokens -= 1;
+        paced_packets++;
+        pace_delay += now - s->slots[seq].queued_at;
+        if (s->slots[seq].unsent) {
+            /* time the packet from when it really leaves */
+            s->slots[seq].unsent = false;
+            s->slots[seq].sent_at = now;
+            if (seq == s->window_base)
+                settimer(s->timers, TIMER_RETX, s->rto);
+        }
+        transmit(s, seq);
+    }
+    /* count from tokens_at, which is ahead of the clock when the timer */
+    /* fired a rounding error early                                      */
+    if (s->paceq_count > 0)
+        settimer(s->timers, TIMER_PACE,
+                 s->tokens_at + (1 - s->tokens) / pace_rate(s) - simtime());
+}
+
+/* hand packet seq to layer 3, through the pacer when pacing */
+static void send_packet(struct sender *s, int seq)
+{
+    if (!pace) {
+        transmit(s, seq);
+        return;
+    }
+    if (!s->slots[seq].inpaceq) {
+        s->paceq[(s->paceq_head + s->paceq_count) % seqspace] = seq;
+        s->paceq_count++;
+        s->slots[seq].inpaceq = true;
+        s->slots[seq].queued_at = simtime();
+    }
+    if (!timerrunning(s->timers, TIMER_PACE))
+        pace_release(s, simtime());
+}
+
+/* buffers that hold either a whole message or a coalesced batch */
+#define MSGBUFSIZE (msgsize > mtu ? msgsize : mtu)
+
+/* a message longer than the mtu is split into segments; those that do not */
+/* fit in the window yet wait in pending until ACKs open slots              */
+
+/* put one segment of a message into the window and send it to layer 3 */
+static void send_segment(struct sender *s, char *data, int length, int flags)
+{
+    struct pkt sendpkt;
+
+    sendpkt.seqnum = s->nextseqnum;
+    sendpkt.acknum = NOTINUSE;
+    sendpkt.length = length;
+    sendpkt.flags = flags;
+    sendpkt.connid = s->connid;
+    sendpkt.payload = s->slots[sendpkt.seqnum].packet.payload;
+    memcpy(sendpkt.payload, data, length);
+    sendpkt.checksum = ComputeChecksum(sendpkt);
+
+    s->slots[sendpkt.seqnum].packet = sendpkt;
+    s->slots[sendpkt.seqnum].acked = false;
+    s->slots[sendpkt.seqnum].sent_at = simtime();
+    s->slots[sendpkt.seqnum].recovered_by = RECOVER_NONE;
+    s->slots[sendpkt.seqnum].sentas = s->sendcount++;
+    s->slots[sendpkt.seqnum].unsent = true;
+    s->windowcount++;
+
+    if (TRACE > 0)
+        printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
+    send_packet(s, sendpkt.seqnum);
+
+    if (s->windowcount == 1)
+        settimer(s->timers, TIMER_RETX, s->rto);
+
+    s->nextseqnum = (s->nextseqnum + 1) % seqspace;
+}
+
+/* with latency=1 the receiver times how long out-of-order packets wait in */
+/* recv_buffer, and each message's arrival time is kept in its sender's    */
+/* msgtimes until the peer's receiver delivers it.  Messages are delivered */
+/* in the order they arrived, so it takes the oldest; those the sender     */
+/* drops are taken out.  The receiver reads its peer's sender, which the   */
+/* parallel engine (threads=) runs on another thread, so there only the    */
+/* time packets are held is measured, as under parallelorder=1             */
+static bool latency;
+static bool msglatency;
+
+/* make room in msgtimes for one more */
+static void msgtimes_grow(struct sender *s)
+{
+    double *grown;
+    int i, size;
+
+    if (s->msgtimes_count < s->msgtimes_size)
+        return;
+    size = 2 * s->msgtimes_size + 16;
+    grown = malloc(size * sizeof(double));
+    if (grown == NULL) {
+        printf("memory allocation for message times failed.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < s->msgtimes_count; i++)
+        grown[i] = s->msgtimes[(s->msgtimes_head + i) % s->msgtimes_size];
+    free(s->msgtimes);
+    s->msgtimes = grown;
+    s->msgtimes_head = 0;
+    s->msgtimes_size = size;
+}
+
+/* note a message arriving from layer 5 */
+static void msgtime_arrived(struct sender *s)
+{
+    if (!msglatency)
+        return;
+    msgtimes_grow(s);
+    s->msgtimes[(s->msgtimes_head + s->msgtimes_count) % s->msgtimes_size] = simtime();
+    s->msgtimes_count++;
+}
+
+/* forget n messages dropped by the sender, the oldest of them at position */
+/* first of msgtimes; the newest n when first is -1                        */
+static void msgtime_dropped(struct sender *s, int first, int n)
+{
+    int i;
+
+    if (first < 0)
+        first = s->msgtimes_count - n;
+    if (first < 0 || first + n > s->msgtimes_count)
+        return;
+    for (i = first; i + n < s->msgtimes_count; i++)
+        s->msgtimes[(s->msgtimes_head + i) % s->msgtimes_size] =
+            s->msgtimes[(s->msgtimes_head + i + n) % s->msgtimes_size];
+    s->msgtimes_count -= n;
+}
+
+/* the receiver r passed a message to layer 5, or discarded it */
+static void msgtime_delivered(struct receiver *r, bool delivered)
+{
+    struct sender *s;
+    double t;
+
+    if (!msglatency)
+        return;
+    s = &senders[r->entity == A ? B : A][r->connid];
+    if (s->msgtimes_count == 0)
+        return;
+    t = simtime() - s->msgtimes[s->msgtimes_head];
+    s->msgtimes_head = (s->msgtimes_head + 1) % s->msgtimes_size;
+    s->msgtimes_count--;
+    if (!delivered)
+        return;
+    latency_add(msg_latency, t);
+    msg_latency_total += t;
+    if (t > msg_latency_max)
+        msg_latency_max = t;
+}
+
+static int backlog_size;     /* capacity in messages */
+static int backlog_overflow; /* OVERFLOW_TAIL or OVERFLOW_HEAD */
+
+/* copy a message into the tail of the backlog, applying the overflow policy */
+static void backlog_push(struct sender *s, char *data, int length, int flags, int nmsgs)
+{
+    struct backlog_entry *entry;
+    int i, queued;
+
+    if (s->backlog_count == backlog_size) {
+        if (backlog_overflow == OVERFLOW_TAIL) {
+            if (TRACE > 0)
+                printf("----%c: backlog is full, message dropped\n", 'A' + s->entity);
+            window_full += nmsgs;
+            msgtime_dropped(s, -1, nmsgs);
+            return;
+        }
+        if (TRACE > 0)
+            printf("----%c: backlog is full, oldest message dropped\n", 'A' + s->entity);
+        window_full += s->backlog[s->backlog_head].nmsgs;
+        /* the backlog's messages come just before the arriving ones in msgtimes */
+        for (i = 0, queued = 0; i < s->backlog_count; i++)
+            queued += s->backlog[(s->backlog_head + i) % backlog_size].nmsgs;
+        msgtime_dropped(s, s->msgtimes_count - nmsgs - queued, s->backlog[s->backlog_head].nmsgs);
+        s->backlog_head = (s->backlog_head + 1) % backlog_size;
+        s->backlog_count--;
+    }
+    entry = &s->backlog[(s->backlog_head + s->backlog_count) % backlog_size];
+    if (entry->data == NULL) {
+        entry->data = malloc(MSGBUFSIZE);
+        if (entry->data == NULL) {
+            printf("memory allocation for backlog failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(entry->data, data, length);
+    entry->length = length;
+    entry->flags = flags;
+    entry->nmsgs = nmsgs;
+    entry->enqueued = simtime();
+    s->backlog_count++;
+    if (s->backlog_count > backlog_highwater)
+        backlog_highwater = s->backlog_count;
+}
+
+/* send segments of data[*off..length) while the window has room */
+static void send_segments(struct sender *s, char *data, int length, int flags, int *off)
+{
+    int seglen;
+
+    while (*off < length && s->windowcount < send_limit(s)) {
+        seglen = length - *off < mtu ? length - *off : mtu;
+        send_segment(s, data + *off, seglen, flags | (*off + seglen < length ? SEG_MORE : 0));
+        *off += seglen;
+    }
+}
+
+/* fill the window from the pending message and then from the backlog */
+static void drain_backlog(struct sender *s)
+{
+    struct backlog_entry *entry;
+    char *swap;
+    double delay;
+
+    while (s->windowcount < send_limit(s)) {
+        if (s->pending_len > 0) {
+            send_segments(s, s->pending, s->pending_len, s->pending_flags, &s->pending_off);
+            if (s->pending_off < s->pending_len)
+                return;
+            s->pending_len = 0;
+        }
+        if (s->backlog_count == 0)
+            return;
+
+        entry = &s->backlog[s->backlog_head];
+        s->backlog_head = (s->backlog_head + 1) % backlog_size;
+        s->backlog_count--;
+        delay = simtime() - entry->enqueued;
+        backlog_queued += entry->nmsgs;
+        backlog_delay += delay * entry->nmsgs;
+        if (delay > backlog_maxdelay)
+            backlog_maxdelay = delay;
+        if (TRACE > 1)
+            printf("----%c: message leaves the backlog after %f\n", 'A' + s->entity, delay);
+
+        /* the entry becomes the pending message; its old buffer goes back in the ring */
+        swap = s->pending;
+        s->pending = entry->data;
+        entry->data = swap;
+        s->pending_len = entry->length;
+        s->pending_flags = entry->flags;
+        s->pending_off = 0;
+    }
+}
+
+/* hand a message, or a batch of nmsgs coalesced messages, to the window, */
+/* the backlog, or drop it when neither has room                          */
+static void submit(struct sender *s, char *data, int length, int flags, int nmsgs)
+{
+    int off = 0;
+
+    if (s->windowcount < send_limit(s) && s->pending_len == 0 && s->backlog_count == 0) {
+        if (TRACE > 1)
+        printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n",
+               'A' + s->entity);
+
+        send_segments(s, data, length, flags, &off);
+        if (off < length) {
+            /* keep the segments that did not fit for when the window opens */
+            memcpy(s->pending, data, length);
+            s->pending_len = length;
+            s->pending_flags = flags;
+            s->pending_off = off;
+        }
+    } else if (backlog_size > 0) {
+        if (TRACE > 1)
+            printf("----%c: New message arrives, send window is full, message queued\n",
+                   'A' + s->entity);
+        backlog_push(s, data, length, flags, nmsgs);
+    } else {
+        if (TRACE > 0)
+            printf("----%c: New message arrives, send window is full\n", 'A' + s->entity);
+        window_full += nmsgs;
+        msgtime_dropped(s, -1, nmsgs);
+    }
+}
+
+/* with coalesce=1, messages small enough to share a packet are packed into */
+/* one mtu-sized batch, each behind a BATCH_HDR length prefix.  The batch is */
+/* sent when the next message does not fit or flushdelay after it was begun */
+static bool coalesce;
+static double flushdelay;
+
+static void flush_batch(struct sender *s)
+{
+    if (s->batch_count == 0)
+        return;
+    canceltimer(s->timers, TIMER_FLUSH);
+    if (TRACE > 1)
+        printf("----%c: flushing %d coalesced messages (%d bytes)\n", 'A' + s->entity,
+               s->batch_count, s->batch_len);
+    coalesce_saved += s->batch_count - 1;
+    coalesce_delay += s->batch_count * simtime() - s->batch_arrivals;
+    submit(s, s->batch, s->batch_len, SEG_BATCH, s->batch_count);
+    s->batch_len = 0;
+    s->batch_count = 0;
+    s->batch_arrivals = 0;
+}
+
+static void coalesce_message(struct sender *s, struct msg message)
+{
+    if (s->batch_len + BATCH_HDR + message.length > mtu)
+        flush_batch(s);
+    if (s->batch_count == 0)
+        settimer(s->timers, TIMER_FLUSH, flushdelay);
+    s->batch[s->batch_len] = (char)((message.length >> 8) & 0xff);
+    s->batch[s->batch_len + 1] = (char)(message.length & 0xff);
+    memcpy(s->batch + s->batch_len + BATCH_HDR, message.data, message.length);
+    s->batch_len += BATCH_HDR + message.length;
+    s->batch_count++;
+    s->batch_arrivals += simtime();
+    coalesced_msgs++;
+    msgtime_arrived(s);
+}
+
+/* a message from layer 5 at the sender's entity */
+static void sender_output(struct sender *s, struct msg message)
+{
+    if (coalesce && BATCH_HDR + message.length <= mtu) {
+        coalesce_message(s, message);
+        return;
+    }
+    flush_batch(s);   /* keep messages in order behind anything already coalesced */
+    msgtime_arrived(s);
+    submit(s, message.data, message.length, 0, 1);
+}
+
+/* mark acknum acked if it is in the send window; true if it was not already */
+static bool ack_one(struct sender *s, int acknum)
+{
+    double latency;
+
+    if (!in_send_window(s, acknum)) {
+        if (TRACE > 2)
+            printf("----%c: ACK %d is outside window [%d, %d), ignored\n", 'A' + s->entity,
+                   acknum, s->window_base, (s->window_base + windowsize) % seqspace);
+        return false;
+    }
+    if (s->slots[acknum].acked) {
+        if (TRACE > 0)
+            printf("----%c: duplicate ACK received, do nothing!\n", 'A' + s->entity);
+        return false;
+    }
+    if (TRACE > 0)
+        printf("----%c: ACK %d is not a duplicate\n", 'A' + s->entity, acknum);
+    s->slots[acknum].acked = true;
+    new_ACKs++;
+
+    latency = simtime() - s->slots[acknum].sent_at;
+    if (s->slots[acknum].recovered_by == RECOVER_NONE)
+        rtt_sample(s, latency);   /* Karn: resent packets give ambiguous samples */
+    else if (s->slots[acknum].recovered_by == RECOVER_TIMEOUT) {
+        recovered_timeout++;
+        recovery_timeout_time += latency;
+    } else if (s->slots[acknum].recovered_by == RECOVER_NAK) {
+        recovered_nak++;
+        recovery_nak_time += latency;
+    }
+    return true;
+}
+
+/* acknowledge everything from window_base up to acknum, unless acknum is */
+/* stale, from before window_base moved                                   */
+static int ack_cumulative(struct sender *s, int acknum)
+{
+    int i;
+    int newacks = 0;
+
+    if ((acknum - s->window_base + seqspace) % seqspace <= s->windowcount)
+        for (i = s->window_base; i != acknum; i = (i + 1) % seqspace)
+            newacks += ack_one(s, i);
+    return newacks;
+}
+
+/* newacks packets were acknowledged: slide the window, refill it and */
+/* restart the timer for the oldest packet still unacked              */
+static void window_advance(struct sender *s, int newacks)
+{
+    int i;
+
+    cc->acked(s, newacks);
+    while (s->slots[s->window_base].acked) {
+        s->slots[s->window_base].acked = false;
+        s->window_base = (s->window_base + 1) % seqspace;
+        s->windowcount--;
+    }
+
+    drain_backlog(s);
+
+    canceltimer(s->timers, TIMER_RETX);
+    for (i = 0; i < seqspace; i++) {
+        int seq = (s->window_base + i) % seqspace;
+        if (!s->slots[seq].acked && i < s->windowcount) {
+            settimer(s->timers, TIMER_RETX, s->rto);
+            break;
+        }
+    }
+}
+
+/* the receiver reported seqnums missing: resend those still unacked */
+/* without waiting for the timeout                                    */
+static void handle_nak(struct sender *s, struct pkt packet)
+{
+    int seq;
+    bool lost = false;
+
+    for (seq = 0; seq < seqspace && seq / 8 < packet.length; seq++)
+        if ((packet.payload[seq / 8] & (1 << (seq % 8))) && in_send_window(s, seq) && !s->slots[seq].acked) {
+            if (TRACE > 0)
+                printf("---%c: NAK, resending packet %d\n", 'A' + s->entity, seq);
+            send_packet(s, seq);
+            packets_resent++;
+            flowstats[s->connid].resent++;
+            nak_resends++;
+            if (s->slots[seq].recovered_by == RECOVER_NONE)
+                s->slots[seq].recovered_by = RECOVER_NAK;
+            if (seq == s->window_base)   /* the timeout would only resend it again */
+                settimer(s->timers, TIMER_RETX, s->rto);
+            lost = true;
+        }
+    if (lost)
+        cc->lost(s, LOSS_NAK);
+}
+
+/* an ACK or NAK packet for the sender */
+static void sender_input(struct sender *s, struct pkt packet)
+{
+    int i;
+    int newacks = 0;
+
+    if (!IsCorrupted(packet)) {
+        if (TRACE > 0)
+            printf("----%c: uncorrupted ACK %d is received\n", 'A' + s->entity, packet.acknum);
+        if (packet.flags & PKT_NAK) {
+            handle_nak(s, packet);
+            return;
+        }
+        total_ACKs_received++;
+
+        if (packet.flags & ACK_MULTI) {
+            for (i = 0; i < seqspace && i / 8 < packet.length; i++)
+                if (packet.payload[i / 8] & (1 << (i % 8)))
+                    newacks += ack_one(s, i);
+        }
+        else if (packet.flags & ACK_SACK) {
+            /* everything from window_base up to recv_base has been received */
+            newacks = ack_cumulative(s, packet.acknum);
+            for (i = 0; i < windowsize && i / 8 < packet.length; i++)
+                if (packet.payload[i / 8] & (1 << (i % 8)))
+                    newacks += ack_one(s, (packet.acknum + i) % seqspace);
+        }
+        else
+            newacks = ack_one(s, packet.acknum);
+
+        if (newacks > 0)
+            window_advance(s, newacks);
+    } else {
+        if (TRACE > 0)
+            printf("----%c: corrupted ACK is received, do nothing!\n", 'A' + s->entity);
+    }
+}
+
+/* retransmission timeout: resend the oldest unacked packet */
+static void retransmit(struct sender *s)
+{
+    int i;
+    if (TRACE > 0)
+        printf("----%c: time out,resend packets!\n", 'A' + s->entity);
+
+    for (i = 0; i < s->windowcount; i++) {
+        int seq = (s->window_base + i) % seqspace;
+        if (!s->slots[seq].acked) {
+            if (TRACE > 0)
+                printf("---%c: resending packet %d\n", 'A' + s->entity, s->slots[seq].packet.seqnum);
+            send_packet(s, seq);
+            packets_resent++;
+            flowstats[s->connid].resent++;
+            timeouts++;
+            if (s->slots[seq].recovered_by == RECOVER_NONE)
+                s->slots[seq].recovered_by = RECOVER_TIMEOUT;
+            rto_backoff(s);
+            cc->lost(s, LOSS_TIMEOUT);
+            settimer(s->timers, TIMER_RETX, s->rto);
+            break;
+        }
+    }
+}
+
+/* size the window and sequence space from the window= option; called by */
+/* both entities since either may be initialised first                   */
+void window_layout(int *window, int *space)
+{
+    *window = (int)getoption("window", 6);
+    if (*window < 1)
+        *window = 1;
+    if (*window > MAXWINDOW)
+        *window = MAXWINDOW;
+    /* a larger space keeps packets the channel has reordered or held back */
+    /* from being taken for ones a whole cycle of seqnums later            */
+    *space = (int)getoption("seqspace", 2 * *window);
+    if (*space < 2 * *window)
+        *space = 2 * *window;
+    if (*space > MAXSEQSPACE)
+        *space = MAXSEQSPACE;
+}
+
+static void window_init(void)
+{
+    bidirectional = getoption("bidirectional", BIDIRECTIONAL) != 0;
+    window_layout(&windowsize, &seqspace);
+    sendwindow = (int)getoption("sendwindow", windowsize);
+    if (sendwindow < 1)
+        sendwindow = 1;
+    if (sendwindow > windowsize)
+        sendwindow = windowsize;
+    ackmapsize = (seqspace + 7) / 8;
+    latency = getoption("latency", 0) != 0;
+    msglatency = latency && getoption("threads", 0) == 0 && getoption("parallelorder", 0) == 0;
+}
+
+/* set up the sender of flow connid at entity AorB, whose slots are in place */
+static void sender_init(struct sender *s, int AorB, int connid)
+{
+    int i;
+
+  s->entity = AorB;
+  s->connid = connid;
+  s->timers = &timersets[AorB][connid];
+  /* initialise the window, buffer and sequence number */
+  s->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  s->window_base = 0;
+  s->windowcount = 0;
+
+  s->rto = RTT;
+  if (reported(s))
+      rto_last = s->rto;
+  s->srtt = -1;
+  s->rttvar = 0;
+
+  s->cwnd = 0;
+  if (reported(s))
+      cwnd_changed = 0;
+  s->sendcount = 0;
+  cc->init(s);
+
+  s->tokens = paceburst;
+  s->tokens_at = 0;
+  s->paceq_head = 0;
+  s->paceq_count = 0;
+
+  for (i = 0; i < seqspace; i++) {
+        s->slots[i].acked = false;
+        s->slots[i].inpaceq = false;
+        s->slots[i].packet.payload = malloc(mtu);
+        if (s->slots[i].packet.payload == NULL) {
+            printf("memory allocation for payload buffers failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+  s->pending = malloc(MSGBUFSIZE);
+  if (s->pending == NULL) {
+      printf("memory allocation for message buffer failed.");
+      exit(EXIT_FAILURE);
+  }
+  s->pending_len = 0;
+
+  s->backlog_head = 0;
+  s->backlog_count = 0;
+  if (backlog_size > 0) {
+      s->backlog = calloc(backlog_size, sizeof(struct backlog_entry));
+      if (s->backlog == NULL) {
+          printf("memory allocation for backlog failed.");
+          exit(EXIT_FAILURE);
+      }
+  }
+
+  s->batch = malloc(mtu);
+  if (s->batch == NULL) {
+      printf("memory allocation for coalescing buffer failed.");
+      exit(EXIT_FAILURE);
+  }
+  s->batch_len = 0;
+  s->batch_count = 0;
+  s->batch_arrivals = 0;
+
+  s->msgtimes = NULL;
+  s->msgtimes_head = 0;
+  s->msgtimes_count = 0;
+  s->msgtimes_size = 0;
+}
+
+/* read the sender options and set up the senders of every flow at AorB */
+static void senders_init(int AorB)
+{
+    struct slot *slots;
+    int *paceq;
+    int i;
+    const char *name;
+
+  rto_policy = strcmp(getoptionstr("rto", "fixed"), "adaptive") == 0 ? RTO_ADAPTIVE : RTO_FIXED;
+  rto_min = getoption("rtomin", 1.0);
+  rto_max = getoption("rtomax", 64 * RTT);
+
+  name = getoptionstr("cc", "none");
+  cc = NULL;
+  for (i = 0; i < (int)(sizeof(controllers) / sizeof(controllers[0])); i++)
+      if (strcmp(controllers[i].name, name) == 0)
+          cc = &controllers[i];
+  if (cc == NULL) {
+      printf("unknown congestion controller %s.", name);
+      exit(EXIT_FAILURE);
+  }
+
+  pace = getoption("pace", 0) != 0;
+  pacerate = getoption("pacerate", 0);
+  paceburst = getoption("paceburst", 1);
+  if (paceburst < 1)
+      paceburst = 1;
+
+  backlog_size = (int)getoption("backlog", 0);
+  backlog_overflow = strcmp(getoptionstr("overflow", "tail"), "head") == 0 ?
+                     OVERFLOW_HEAD : OVERFLOW_TAIL;
+
+  coalesce = getoption("coalesce", 0) != 0;
+  flushdelay = getoption("flushdelay", 2.0);
+
+  senders[AorB] = calloc(nflows, sizeof(struct sender));
+  slots = calloc((size_t)nflows * seqspace, sizeof(struct slot));
+  paceq = malloc((size_t)nflows * seqspace * sizeof(int));
+  if (senders[AorB] == NULL || slots == NULL || paceq == NULL) {
+      printf("memory allocation for the flow table failed.");
+      exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nflows; i++) {
+      senders[AorB][i].slots = slots + (size_t)i * seqspace;
+      senders[AorB][i].paceq = paceq + (size_t)i * seqspace;
+      sender_init(&senders[AorB][i], AorB, i);
+  }
+}
+
+/********* Receiver variables and procedures ************/
+
+/* with sack=1, every ACK from the receiver reports its whole receive window */
+static bool sack;
+
+/* with nak=1, the receiver asks for the packets missing below an          */
+/* out-of-order arrival straight away.  A seqnum is NAKed again only after */
+/* naksuppress, and NAK packets are spaced at least nakpace apart; NAKs    */
+/* held back by the pacing are sent together when it allows                */
+static bool nak;
+static double naksuppress;
+static double nakpace;
+
+/* with delack=1, the receiver holds ACKs back for up to ackdelay and until */
+/* ackmax arrivals are pending, then acknowledges them all in one ACK_MULTI */
+/* ACK.  It is on by default with bidirectional=1, so ACKs can wait for a   */
+/* data packet to ride on                                                   */
+static bool delack;
+static double ackdelay;
+static int ackmax;
+
+/* send one ACK packet, with a bitmap payload for ACK_MULTI and ACK_SACK */
+static void sendack(struct receiver *r, int acknum, int flags, char *map)
+{
+    struct pkt sendpkt;
+
+    sendpkt.seqnum = r->nextseqnum;
+    sendpkt.connid = r->connid;
+    r->nextseqnum = (r->nextseqnum + 1) % 2;
+    sendpkt.acknum = acknum;
+    sendpkt.length = map != NULL ? ackmapsize : 0;
+    sendpkt.flags = flags;
+    sendpkt.payload = map;
+    sendpkt.checksum = ComputeChecksum(sendpkt);
+    tolayer3(r->entity, sendpkt);
+    acks_sent++;
+    ackbytes_sent += headersize + sendpkt.length;
+}
+
+/* send a SACK: recv_base and a bitmap of what recv_buffer holds after it */
+static void sendsack(struct receiver *r)
+{
+    char map[MAXACKMAP];
+    int i;
+
+    memset(map, 0, sizeof(map));
+    for (i = 0; i < windowsize; i++)
+        if (r->received[i])
+            map[i / 8] |= (char)(1 << (i % 8));
+    if (TRACE > 2)
+        printf("----%c: Send SACK %d\n", 'A' + r->entity, r->recv_base);
+    sendack(r, r->recv_base, ACK_SACK, map);
+}
+
+/* send the delayed ACK covering every arrival since the last one */
+static void flushacks(struct receiver *r)
+{
+    if (r->ackcount == 0)
+        return;
+    canceltimer(r->timers, TIMER_DELACK);
+    if (TRACE > 2)
+        printf("----%c: Send ACK for %d arrivals\n", 'A' + r->entity, r->ackcount);
+    acks_coalesced += r->ackcount - 1;
+    if (sack)
+        sendsack(r);
+    else
+        sendack(r, r->acklast, ACK_MULTI, r->ackmap);
+    memset(r->ackmap, 0, sizeof(r->ackmap));
+    r->ackcount = 0;
+}
+
+/* send the NAKs collected in nakmap, or wait for the pacing to allow it */
+static void flushnaks(struct receiver *r)
+{
+    int first;
+
+    if (!r->nakwaiting)
+        return;
+    if (r->lastnak >= 0 && simtime() - r->lastnak < nakpace) {
+        if (!timerrunning(r->timers, TIMER_NAK))
+            settimer(r->timers, TIMER_NAK, r->lastnak + nakpace - simtime());
+        return;
+    }
+    for (first = 0; first < seqspace && !(r->nakmap[first / 8] & (1 << (first % 8))); first++)
+        ;
+    if (TRACE > 0)
+        printf("----%c: Send NAK starting at %d\n", 'A' + r->entity, first);
+    sendack(r, first, PKT_NAK, r->nakmap);
+    acks_sent--;   /* sendack counted it as an ACK */
+    ackbytes_sent -= headersize + ackmapsize;
+    naks_sent++;
+    r->lastnak = simtime();
+    memset(r->nakmap, 0, sizeof(r->nakmap));
+    r->nakwaiting = false;
+}
+
+/* a packet arrived at rel_pos: NAK the gaps in front of it */
+static void nakgaps(struct receiver *r, int rel_pos)
+{
+    int i;
+    int seq;
+
+    for (i = 0; i < rel_pos; i++) {
+        seq = (r->recv_base + i) % seqspace;
+        if (r->received[i] || (r->naked_at[seq] >= 0 && simtime() - r->naked_at[seq] < naksuppress))
+            continue;
+        r->naked_at[seq] = simtime();
+        r->nakmap[seq / 8] |= (char)(1 << (seq % 8));
+        r->nakwaiting = true;
+    }
+    flushnaks(r);
+}
+
+/* acknowledge seqnum, at once or by adding it to the delayed ACK */
+static void acknowledge(struct receiver *r, int seqnum)
+{
+    if (!delack) {
+        if (sack)
+            sendsack(r);
+        else
+            sendack(r, seqnum, 0, NULL);
+        return;
+    }
+    r->ackmap[seqnum / 8] |= (char)(1 << (seqnum % 8));
+    r->acklast = seqnum;
+    r->ackcount++;
+    if (r->ackcount >= ackmax)
+        flushacks(r);
+    else if (!timerrunning(r->timers, TIMER_DELACK))
+        settimer(r->timers, TIMER_DELACK, ackdelay);
+}
+
+/* deliver each message of a coalesced batch to layer 5 */
+static void unbatch(struct receiver *r, struct pkt *segment)
+{
+    int off = 0;
+    int len;
+
+    while (off + BATCH_HDR <= segment->length) {
+        len = ((unsigned char)segment->payload[off] << 8) |
+              (unsigned char)segment->payload[off + 1];
+        off += BATCH_HDR;
+        if (off + len > segment->length)
+            break;
+        tolayer5(r->entity, segment->payload + off, len, r->connid);
+        msgtime_delivered(r, true);
+        off += len;
+    }
+}
+
+/* append an in-order segment to the application buffer; deliver on the last one */
+static void reassemble(struct receiver *r, struct pkt *segment)
+{
+    if (segment->flags & SEG_BATCH) {
+        unbatch(r, segment);
+        return;
+    }
+    if (r->appfill + segment->length > msgsize)
+        r->appoverflow = true;
+    if (!r->appoverflow) {
+        memcpy(r->appbuf + r->appfill, segment->payload, segment->length);
+        r->appfill += segment->length;
+    }
+    if (!(segment->flags & SEG_MORE)) {
+        if (!r->appoverflow)
+            tolayer5(r->entity, r->appbuf, r->appfill, r->connid);
+        else
+            printf("Warning: message larger than %d bytes discarded at %c\n", msgsize,
+                   'A' + r->entity);
+        msgtime_delivered(r, !r->appoverflow);
+        r->appfill = 0;
+        r->appoverflow = false;
+    }
+}
+
+/* a data packet for the receiver */
+static void receiver_input(struct receiver *r, struct pkt packet)
+{
+    int i, held;
+    char *freed;
+    int seqnum = packet.seqnum;
+    int rel_pos = (seqnum - r->recv_base + seqspace) % seqspace;
+
+    if (!IsCorrupted(packet) && rel_pos < windowsize) {
+        if (TRACE > 0)
+            printf("----%c: packet %d is correctly received, send ACK!\n", 'A' + r->entity,
+                   packet.seqnum);
+        if (r->received[rel_pos])
+            spurious_resends++;
+        else {
+            r->recv_buffer[rel_pos] = packet;
+            r->held_at[rel_pos] = -1;
+            if (rel_pos > 0) {
+                /* out of order: hold a copy until the gap is filled.  An in-order
+                   segment is reassembled below, straight from the packet. */
+                r->recv_buffer[rel_pos].payload = r->recv_payloads[rel_pos];
+                memcpy(r->recv_payloads[rel_pos], packet.payload, packet.length);
+                r->held_at[rel_pos] = simtime();
+            }
+            r->received[rel_pos] = 1;
+            if (TRACE > 2)
+                printf("----%c: Caching package %d to location %d\n", 'A' + r->entity,
+                       seqnum, rel_pos);
+            if (nak && rel_pos > 0 && !r->received[0])
+                nakgaps(r, rel_pos);
+            }
+        if (TRACE > 2)
+            printf("----%c: Send ACK %d\n", 'A' + r->entity, seqnum);
+        acknowledge(r, seqnum);
+    }
+    else {
+        if (TRACE > 0)
+            printf("----%c: packet corrupted or not expected sequence number, resend ACK!\n",
+                   'A' + r->entity);
+        if (!IsCorrupted(packet)) {
+            spurious_resends++;   /* already delivered: resent needlessly */
+            acknowledge(r, seqnum);
+        }
+        else if (!delack && sack)
+            sendsack(r);
+        else if (!delack)   /* seqnum cannot be trusted: repeat the last in-order ACK */
+            sendack(r, (r->recv_base + seqspace - 1) % seqspace, 0, NULL);
+    }
+
+    while (r->received[0]) {
+        reassemble(r, &r->recv_buffer[0]);
+        if (TRACE > 2)
+          printf("----%c: Delivering package %d to layer 5\n", 'A' + r->entity, r->recv_base);
+        packets_received++;
+        if (latency && r->held_at[0] >= 0) {
+          latency_add(hol_wait, simtime() - r->held_at[0]);
+          hol_wait_total += simtime() - r->held_at[0];
+          if (simtime() - r->held_at[0] > hol_wait_max)
+            hol_wait_max = simtime() - r->held_at[0];
+        }
+
+        freed = r->recv_payloads[0];
+        for (i = 0; i < windowsize - 1; i++) {
+          r->received[i] = r->received[i + 1];
+          r->recv_buffer[i] = r->recv_buffer[i + 1];
+          r->recv_payloads[i] = r->recv_payloads[i + 1];
+          r->held_at[i] = r->held_at[i + 1];
+        }
+        r->received[windowsize - 1] = 0;
+        r->recv_payloads[windowsize - 1] = freed;
+        r->recv_base = (r->recv_base + 1) % seqspace;
+
+        if (TRACE > 2)
+          printf("----%c: Receive window slides to base number %d\n", 'A' + r->entity,
+                 r->recv_base);
+    }
+
+    held = 0;
+    for (i = 1; i < windowsize; i++)
+        held += r->received[i];
+    recv_held[held]++;
+}
+
+/* set up the receiver of flow connid at entity AorB */
+static void receiver_init(struct receiver *r, int AorB, int connid)
+{
+    int i;
+
+    r->entity = AorB;
+    r->connid = connid;
+    r->timers = &timersets[AorB][connid];
+    r->recv_base = 0;
+    memset(r->received, 0, sizeof(r->received));
+    r->nextseqnum = 1;
+    allocpayloads(r->recv_payloads, windowsize);
+    r->appbuf = malloc(msgsize);
+    r->naked_at = malloc(seqspace * sizeof(double));
+    if (r->appbuf == NULL || r->naked_at == NULL) {
+        printf("memory allocation for application buffer failed.");
+        exit(EXIT_FAILURE);
+    }
+    r->appfill = 0;
+    r->appoverflow = false;
+
+    for (i = 0; i < seqspace; i++)
+        r->naked_at[i] = -1;
+    memset(r->nakmap, 0, sizeof(r->nakmap));
+    r->nakwaiting = false;
+    r->lastnak = -1;
+    memset(r->ackmap, 0, sizeof(r->ackmap));
+    r->ackcount = 0;
+}
+
+/* read the receiver options and set up the receivers of every flow at AorB */
+static void receivers_init(int AorB)
+{
+    int i;
+
+    sack = getoption("sack", 0) != 0;
+    nak = getoption("nak", 0) != 0;
+    naksuppress = getoption("naksuppress", RTT);
+    nakpace = getoption("nakpace", 1.0);
+    delack = getoption("delack", bidirectional) != 0;
+    ackdelay = getoption("ackdelay", 2.0);
+    ackmax = (int)getoption("ackmax", 2);
+    if ((delack || sack || nak) && mtu < ackmapsize) {
+        printf("mtu too small for an ACK bitmap, delayed and selective ACKs and NAKs disabled\n");
+        delack = false;
+        sack = false;
+        nak = false;
+    }
+
+    receivers[AorB] = calloc(nflows, sizeof(struct receiver));
+    if (receivers[AorB] == NULL) {
+        printf("memory allocation for the flow table failed.");
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nflows; i++)
+        receiver_init(&receivers[AorB][i], AorB, i);
+}
+
+/* with bidirectional=1 a packet is a data packet carrying a piggybacked  */
+/* ACK, or a standalone ACK or NAK.  A corrupted packet cannot be told    */
+/* apart and goes to the receiver, which repeats its ACK as for any other */
+static void duplex_input(struct sender *s, struct receiver *r, struct pkt packet)
+{
+    int newacks;
+
+    if (IsCorrupted(packet)) {
+        receiver_input(r, packet);
+        return;
+    }
+    if (!(packet.flags & PKT_ACK)) {
+        sender_input(s, packet);
+        return;
+    }
+    newacks = ack_cumulative(s, packet.acknum);
+    if (newacks > 0)
+        window_advance(s, newacks);
+    receiver_input(r, packet);
+}
+
+/* a packet arriving at AorB goes to the sender or receiver of its flow */
+static void input(int AorB, struct pkt packet)
+{
+    int flow = packet.connid;
+
+    if (flow < 0 || flow >= nflows) {
+        if (TRACE > 0)
+            printf("----%c: packet for unknown connection %d, dropped\n", 'A' + AorB, flow);
+        return;
+    }
+    if (bidirectional)
+        duplex_input(&senders[AorB][flow], &receivers[AorB][flow], packet);
+    else if (AorB == A)
+        sender_input(&senders[A][flow], packet);
+    else
+        receiver_input(&receivers[B][flow], packet);
+}
+
+/* the logical timers of the flow's sender and receiver that are due */
+static void flowtimers(struct timerset *t, double fired)
+{
+    struct sender *s = senders[t->entity] != NULL ? &senders[t->entity][t->flow] : NULL;
+    struct receiver *r = receivers[t->entity] != NULL ? &receivers[t->entity][t->flow] : NULL;
+
+    if (expired(t, TIMER_RETX, fired))
+        retransmit(s);
+    if (expired(t, TIMER_FLUSH, fired))
+        flush_batch(s);
+    if (expired(t, TIMER_PACE, fired))
+        pace_release(s, fired);
+    if (expired(t, TIMER_DELACK, fired))
+        flushacks(r);
+    if (expired(t, TIMER_NAK, fired))
+        flushnaks(r);
+    rearm(t);
+}
+
+/* the emulator timer of AorB went off: take every flow with a timer due */
+/* off the heap first, so each is handled once even if it sets another   */
+/* timer that is already due                                             */
+static void timerinterrupt(int AorB)
+{
+    double fired = timerfired(AorB);
+    int i, n = 0;
+
+    while (ntimerheap[AorB] > 0 && timerheap[AorB][0]->due <= fired) {
+        duesets[AorB][n++] = timerheap[AorB][0];
+        heapremove(timerheap[AorB][0]);
+    }
+    for (i = 0; i < n; i++)
+        flowtimers(duesets[AorB][i], fired);
+    rearm_entity(AorB);
+}
+
+/********* State saving ************/
+/* the optimistic engine rolls an entity back to a saved state, and a    */
+/* run resumed from a checkpoint starts from one.  Pointers are not      */
+/* saved: the buffers of the live state are kept, and only the bytes in  */
+/* use are saved and read back into them                                 */
+
+static void sender_save(struct sender *s)
+{
+    struct backlog_entry *e;
+    int i;
+
+    statesave(s, sizeof(*s));
+    for (i = 0; i < seqspace; i++) {
+        statesave(&s->slots[i], sizeof(struct slot));
+        if (s->slots[i].packet.length > 0)
+            statesave(s->slots[i].packet.payload, s->slots[i].packet.length);
+    }
+    statesave(s->paceq, seqspace * sizeof(int));
+    statesave(s->pending, s->pending_len);
+    for (i = 0; i < s->backlog_count; i++) {
+        e = &s->backlog[(s->backlog_head + i) % backlog_size];
+        statesave(e, sizeof(*e));
+        statesave(e->data, e->length);
+    }
+    statesave(s->batch, s->batch_len);
+    for (i = 0; i < s->msgtimes_count; i++)
+        statesave(&s->msgtimes[(s->msgtimes_head + i) % s->msgtimes_size], sizeof(double));
+}
+
+static void sender_restore(struct sender *s)
+{
+    struct sender live = *s;
+    struct backlog_entry *e;
+    char *buf;
+    int i, n;
+
+    stateload(s, sizeof(*s));
+    s->timers = live.timers;
+    s->slots = live.slots;
+    s->paceq = live.paceq;
+    s->pending = live.pending;
+    s->backlog = live.backlog;
+    s->batch = live.batch;
+    for (i = 0; i < seqspace; i++) {
+        buf = s->slots[i].packet.payload;
+        stateload(&s->slots[i], sizeof(struct slot));
+        s->slots[i].packet.payload = buf;
+        if (s->slots[i].packet.length > 0)
+            stateload(buf, s->slots[i].packet.length);
+    }
+    stateload(s->paceq, seqspace * sizeof(int));
+    stateload(s->pending, s->pending_len);
+    for (i = 0; i < s->backlog_count; i++) {
+        e = &s->backlog[(s->backlog_head + i) % backlog_size];
+        buf = e->data != NULL ? e->data : malloc(MSGBUFSIZE);
+        if (buf == NULL) {
+            printf("memory allocation for backlog failed.");
+            exit(EXIT_FAILURE);
+        }
+        stateload(e, sizeof(*e));
+        e->data = buf;
+        stateload(e->data, e->length);
+    }
+    stateload(s->batch, s->batch_len);
+    /* the message times are read back oldest first into the live buffer */
+    n = s->msgtimes_count;
+    s->msgtimes = live.msgtimes;
+    s->msgtimes_head = 0;
+    s->msgtimes_count = 0;
+    s->msgtimes_size = live.msgtimes_size;
+    for (i = 0; i < n; i++) {
+        msgtimes_grow(s);
+        stateload(&s->msgtimes[i], sizeof(double));
+        s->msgtimes_count++;
+    }
+}
+
+/* out-of-order packets are held in recv_payloads; an in-order one is */
+/* delivered before the receiver returns                              */
+static void receiver_save(struct receiver *r)
+{
+    int i;
+
+    statesave(r, sizeof(*r));
+    for (i = 1; i < windowsize; i++)
+        if (r->received[i] && r->recv_buffer[i].length > 0)
+            statesave(r->recv_payloads[i], r->recv_buffer[i].length);
+    statesave(r->naked_at, seqspace * sizeof(double));
+    statesave(r->appbuf, r->appfill);
+}
+
+static void receiver_restore(struct receiver *r)
+{
+    struct receiver live = *r;
+    int i;
+
+    stateload(r, sizeof(*r));
+    r->timers = live.timers;
+    memcpy(r->recv_payloads, live.recv_payloads, sizeof(r->recv_payloads));
+    r->naked_at = live.naked_at;
+    r->appbuf = live.appbuf;
+    for (i = 1; i < windowsize; i++)
+        if (r->received[i]) {
+            r->recv_buffer[i].payload = r->recv_payloads[i];
+            if (r->recv_buffer[i].length > 0)
+                stateload(r->recv_payloads[i], r->recv_buffer[i].length);
+        }
+    stateload(r->naked_at, seqspace * sizeof(double));
+    stateload(r->appbuf, r->appfill);
+}
+
+/* the timers, senders and receivers of AorB; the heap is saved as flows */
+static void entity_save(int AorB)
+{
+    int i;
+
+    statesave(timersets[AorB], nflows * sizeof(struct timerset));
+    statesave(&ntimerheap[AorB], sizeof(int));
+    for (i = 0; i < ntimerheap[AorB]; i++)
+        statesave(&timerheap[AorB][i]->flow, sizeof(int));
+    statesave(&armed[AorB], sizeof(double));
+    for (i = 0; senders[AorB] != NULL && i < nflows; i++)
+        sender_save(&senders[AorB][i]);
+    for (i = 0; receivers[AorB] != NULL && i < nflows; i++)
+        receiver_save(&receivers[AorB][i]);
+}
+
+static void entity_restore(int AorB)
+{
+    int i, flow;
+
+    stateload(timersets[AorB], nflows * sizeof(struct timerset));
+    stateload(&ntimerheap[AorB], sizeof(int));
+    for (i = 0; i < ntimerheap[AorB]; i++) {
+        stateload(&flow, sizeof(int));
+        timerheap[AorB][i] = &timersets[AorB][flow];
+    }
+    stateload(&armed[AorB], sizeof(double));
+    for (i = 0; senders[AorB] != NULL && i < nflows; i++)
+        sender_restore(&senders[AorB][i]);
+    for (i = 0; receivers[AorB] != NULL && i < nflows; i++)
+        receiver_restore(&receivers[AorB][i]);
+}
+
+/********* Sender (A) procedures ************/
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(struct msg message)
+{
+    sender_output(&senders[A][message.connid], message);
+}
+
+/* called from layer 3, when a packet arrives for layer 4.  Unless the */
+/* transfer is bidirectional this will always be an ACK or NAK         */
+void A_input(struct pkt packet)
+{
+    input(A, packet);
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt(void)
+{
+    timerinterrupt(A);
+}
+
+/* save A's state, or go back to the state saved */
+void A_save(void)
+{
+    entity_save(A);
+}
+
+void A_restore(void)
+{
+    entity_restore(A);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(void)
+{
+    window_init();
+    timers_init(A);
+    senders_init(A);
+    if (bidirectional)
+        receivers_init(A);
+}
+
+/********* Receiver (B) procedures ************/
+
+/* called from layer 3, when a packet arrives for layer 4 at B */
+void B_input(struct pkt packet)
+{
+    input(B, packet);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void B_init(void)
+{
+    window_init();
+    timers_init(B);
+    receivers_init(B);
+    if (bidirectional)
+        senders_init(B);
+}
+
+/******************************************************************************
+ * The following functions are used only for bi-directional messages          *
+ *****************************************************************************/
+
+/* called from layer 5 at B; with simplex transfer from A to B it is never called */
+void B_output(struct msg message)  
+{
+    sender_output(&senders[B][message.connid], message);
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt(void)
+{
+    timerinterrupt(B);
+}
+
+void B_save(void)
+{
+    entity_save(B);
+}
+
+void B_restore(void)
+{
+    entity_restore(B);
 }
\ No newline at end of file
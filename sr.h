@@ -1,11 +1,19 @@
-extern void A_init(void);
-extern void B_init(void);
-extern void A_input(struct pkt);
-extern void B_input(struct pkt);
-extern void A_output(struct msg);
-extern void A_timerinterrupt(void);
-
-/* included for extension to bidirectional communication */
-#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
-extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void A_init(void);
+extern void B_init(void);
+extern void A_input(struct pkt);
+extern void B_input(struct pkt);
+extern void A_output(struct msg);
+extern void A_timerinterrupt(void);
+extern void A_save(void);
+extern void A_restore(void);
+
+/* default of the bidirectional= option */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+extern void B_output(struct msg);
+extern void B_timerinterrupt(void);
+extern void B_save(void);
+extern void B_restore(void);
+
+/* the window and sequence space A_init() and B_init() lay the buffers */
+/* out for under the current options                                   */
+extern void window_layout(int *, int *);
\ No newline at end of file